@@ -1,28 +1,689 @@
-/* myRISCVSim.h  
-   Header file for myRISCVSim  
-*/ 
+/* myRISCVSim.h
+   Header file for myRISCVSim
+*/
+#ifndef MYRISCVSIM_H
+#define MYRISCVSIM_H
+
 #include<bits/stdc++.h>
+#include <csignal>
 using namespace std;
 
-void run_RISCVsim();
-void reset_proc();
-void load_program_memory(const std::string& file_name);
-void write_data_memory();
-void swi_exit();
+// Guest memory: a sparse two-level page table of 4 KiB pages. a page is
+// allocated on its first write; reads of unallocated memory return zero and
+// never allocate. values are kept little-endian, the same as the host.
+const uint32_t PAGE_SHIFT = 12;
+const uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;
+const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+
+// An instruction after decode: everything decode() needs except the register values.
+struct DecodedInstruction
+{
+    const char *operation;
+    int8_t alu_control_signal; // selects the execute() case, -1 if the record is not filled
+    uint8_t format;            // InstructionFormat
+    uint8_t rd, rs1, rs2;
+    int32_t imm;               // sign-extended immediate, branch/jump offset or upper immediate
+};
+
+struct Page
+{
+    uint8_t data[PAGE_SIZE];
+    uint64_t present[PAGE_SIZE / 64]; // bytes written or loaded, reported in memory.mc
+    uint64_t upper[PAGE_SIZE / 64];   // bytes loaded from upper-case .mc text
+    uint64_t dirty[PAGE_SIZE / 256];  // words stored to since the last take_dirty_ranges(), if track_dirty
+    bool dirty_listed;                // the page is in Memory::dirty_pages
+    DecodedInstruction *decoded;      // one record per word, allocated once code runs from this page
+};
+
+class Hart;
+class CoherenceModel;
+
+// Formats of Memory::dump(): memory.mc text (one "0xADDR 0xWORD" line per word
+// holding a present byte) or a raw image of the range, unallocated pages left as holes
+enum DumpFormat { DUMP_TEXT, DUMP_BINARY };
+
+// Guest memory shared by the harts that run from it. stores that overwrite
+// decoded instructions tell every hart in harts to drop its translated blocks.
+// when harts run on several host threads, shared is set: page and decoded
+// record allocation then take lock, and the present bits are updated
+// atomically. plain loads and stores are not ordered between harts beyond
+// what the host gives; LR/SC and AMOs use host atomics on the guest word.
+class Memory
+{
+public:
+    Memory() = default;
+    Memory(const Memory &) = delete;
+    Memory &operator=(const Memory &) = delete;
+    ~Memory();
+
+    Page **page_table[1024] = {}; // indexed by address bits 31..22, then bits 21..12
+    vector<Hart *> harts;
+    bool shared = false;
+    mutex lock;
+    CoherenceModel *coherence = nullptr; // timing model that mem() reports data accesses to
+
+    // with track_dirty set, stores mark the words they change so that
+    // take_dirty_ranges() costs only the pages written since the last call
+    bool track_dirty = false;
+    vector<uint32_t> dirty_pages; // page numbers with dirty words
+
+    // pages restored from a checkpoint live in this mapping instead of the heap
+    char *checkpoint_image = nullptr;
+    size_t checkpoint_size = 0;
+
+    // Returns the page holding address, or nullptr if it was never written
+    Page *find_page(uint32_t address)
+    {
+        Page **table = __atomic_load_n(&page_table[address >> 22], __ATOMIC_ACQUIRE);
+        return table ? __atomic_load_n(&table[(address >> PAGE_SHIFT) & 0x3ff], __ATOMIC_ACQUIRE) : nullptr;
+    }
+    Page *get_page(uint32_t address);
+    void mark_present(uint32_t address, int count, bool store);
+
+    uint8_t read_mem_byte(uint32_t address);
+    uint16_t read_mem_half(uint32_t address);
+    uint32_t read_mem_word(uint32_t address);
+    void write_mem_byte(uint32_t address, uint8_t value);
+    void write_mem_half(uint32_t address, uint16_t value);
+    void write_mem_word(uint32_t address, uint32_t value);
+
+    const DecodedInstruction *lookup_decoded(uint32_t pc, uint32_t word);
+
+    // Returns the (address, length) ranges of the words stored to since the last call, in address order, and clears them
+    vector<pair<uint32_t, uint32_t>> take_dirty_ranges();
+
+    // Writes the words from start up to (not including) end to file_name, visiting allocated pages only
+    bool dump(const string &file_name, uint32_t start, uint64_t end, DumpFormat format);
+
+    // Loads .mc text, adding a "line N: ..." message to errors for every malformed line
+    bool load_mc(const char *text, size_t size, vector<string> &errors);
+
+    // Copies size bytes to address a page at a time, or zeros if data is null
+    void write_block(uint32_t address, const uint8_t *data, uint32_t size);
+    // Copies every allocated page of image, with its present and upper bits, into this memory
+    void copy_pages(const Memory &image);
+};
+
+// Trace output. everything a hart prints goes through its trace_out, which
+// buffers 1 MiB in user space and only writes it out when full or when the
+// run ends. trace_level picks how much is printed; at TRACE_STAGE the stage
+// lines are further filtered by trace_stages.
+enum TraceLevel { TRACE_OFF, TRACE_SUMMARY, TRACE_INSTRUCTION, TRACE_STAGE };
+enum TraceStage { TRACE_FETCH = 1, TRACE_DECODE = 2, TRACE_EXECUTE = 4, TRACE_MEMORY = 8, TRACE_WRITEBACK = 16 };
+const int TRACE_ALL_STAGES = 31;
+
+class TraceBuffer : public streambuf
+{
+public:
+    TraceBuffer() : buffer(1 << 20) { setp(buffer.data(), buffer.data() + buffer.size()); }
+
+    FILE *out = stdout;        // where the buffered text goes
+    string *capture = nullptr; // when set, the text is appended here instead
+
+    void write_out()
+    {
+        if (capture)
+        {
+            capture->append(pbase(), pptr() - pbase());
+        }
+        else
+        {
+            fwrite(pbase(), 1, pptr() - pbase(), out);
+            fflush(out);
+        }
+        setp(buffer.data(), buffer.data() + buffer.size());
+    }
+
+protected:
+    int overflow(int c) override
+    {
+        write_out();
+        if (c != EOF)
+        {
+            *pptr() = static_cast<char>(c);
+            pbump(1);
+        }
+        return c;
+    }
+    int sync() override
+    {
+        write_out();
+        return 0;
+    }
+
+private:
+    vector<char> buffer;
+};
+
+// Binary execution trace. instead of the stage text, one fixed-size record is
+// written per retired instruction; mcdump turns a trace file back into the
+// FETCH/DECODE/EXECUTE/MEMORY/WRITEBACK text by replaying it. the header keeps
+// the register file at the first record so register values can be rebuilt.
+const char BINARY_TRACE_MAGIC[8] = {'R', 'V', 'T', 'R', 'A', 'C', 'E', '2'};
+const size_t BINARY_TRACE_BATCH = 1 << 16; // records are written out 64K at a time
+
+struct BinaryTraceHeader
+{
+    char magic[8];
+    int64_t clock_cycles; // clock cycle count before the first record
+    uint32_t record_size;
+    uint32_t X[32];       // register file before the first record
+    uint32_t X_written;
+};
+
+// mem field: width in bytes in the low 4 bits, plus the kind of access
+const uint8_t BINARY_TRACE_LOAD = 0x10;
+const uint8_t BINARY_TRACE_STORE = 0x20;
+// flags field
+const uint8_t BINARY_TRACE_TAKEN = 0x01; // a branch or jump left the fall-through path
+
+struct BinaryTraceRecord
+{
+    uint32_t pc;
+    uint32_t instruction;
+    uint32_t rd_value;    // value written back, valid when rd != 0
+    uint32_t mem_address; // valid when mem != 0
+    uint32_t mem_value;   // value loaded or stored
+    uint8_t rd;           // destination register, 0 when nothing is written back
+    uint8_t mem;
+    uint8_t flags;
+    uint8_t reserved;
+};
+
+// Pause point for running a program in phases. run_RISCVsim() and
+// run_RISCVsim_fast() return once clock_cycles reaches stop_cycle or the next
+// instruction is at stop_pc, leaving terminate1 false; calling either engine
+// again continues from the same state. stop_cycle is volatile because a signal
+// handler may set it to pause the run; an aligned 64-bit store is not torn on
+// the 64-bit hosts the engines are built for.
+const long long NO_STOP_CYCLE = LLONG_MAX;
+const uint32_t NO_STOP_PC = 0xffffffff;
+
+// stop_cycle for count more instructions from now, saturating at NO_STOP_CYCLE
+inline long long stop_cycle_after(long long now, long long count)
+{
+    return (count >= NO_STOP_CYCLE - now) ? NO_STOP_CYCLE : now + count;
+}
+
+// reservation_address of a hart with no LR/SC reservation
+const uint32_t NO_RESERVATION = 0xffffffff;
+
+// MESI coherence timing model (--coherence). every hart has a private L1 data
+// cache, and mem() reports each load, store and atomic to the model, which
+// keeps the caches coherent over a snooping bus or a directory. the model only
+// counts events and stall cycles; the data itself always lives in Memory.
+enum MesiState : uint8_t { MESI_INVALID, MESI_SHARED, MESI_EXCLUSIVE, MESI_MODIFIED };
+enum CoherenceProtocol { COHERENCE_BUS, COHERENCE_DIRECTORY };
+
+// latencies in cycles
+const int L1_HIT_LATENCY = 1;
+const int BUS_LATENCY = 10;            // one bus transaction: request, snoop or upgrade
+const int CACHE_TO_CACHE_LATENCY = 20; // line supplied by another L1
+const int MEMORY_LATENCY = 100;
+const int DIRECTORY_LATENCY = 15;      // directory lookup
+const int NETWORK_HOP_LATENCY = 8;     // one point-to-point message
+
+struct CacheLine
+{
+    uint32_t line = 0;     // address >> line_shift
+    uint8_t state = MESI_INVALID;
+    uint64_t last_use = 0; // for LRU
+    uint64_t accessed = 0; // bytes this core used since it got the line, for false sharing
+};
+
+struct CoherenceStats
+{
+    long long loads = 0, stores = 0, hits = 0, misses = 0;
+    long long coherence_misses = 0;      // misses on a line another core invalidated
+    long long upgrades = 0;              // stores to a shared line
+    long long invalidations_sent = 0, invalidations_received = 0;
+    long long writebacks = 0;            // modified lines evicted or flushed
+    long long stall_cycles = 0;          // cycles beyond an L1 hit
+    long long coherence_stall_cycles = 0; // of which upgrades, invalidations and coherence misses
+};
+
+struct LineHotspot
+{
+    long long invalidations = 0;
+    long long false_sharing = 0; // invalidations of a copy whose bytes the writer did not touch
+};
+
+class CoherenceModel
+{
+public:
+    CoherenceModel(int cores, CoherenceProtocol protocol, int sets, int ways, int line_size);
+
+    // records a data access of `bytes` bytes by core; atomics are stores
+    void access(int core, uint32_t address, int bytes, bool store);
+    void report(ostream &out, const vector<long long> &instructions);
+
+private:
+    void access_line(int core, uint32_t line, uint64_t mask, bool store);
+    CacheLine *find(int core, uint32_t line);
+    CacheLine *allocate(int core, uint32_t line);
+    int invalidate_others(int core, uint32_t line, uint64_t mask);
+
+    CoherenceProtocol protocol;
+    int cores, sets, ways, line_shift;
+    vector<CacheLine> lines;                  // cores * sets * ways
+    vector<CoherenceStats> stats;             // per core
+    vector<unordered_set<uint32_t>> lost;     // lines invalidated in each core by others
+    unordered_map<uint32_t, LineHotspot> hotspots;
+    long long transactions = 0;               // bus transactions or directory messages
+    uint64_t tick = 0;
+    mutex lock;                               // harts on several threads share the model
+};
+
+// Five-stage pipeline timing model (--pipeline). the explain engine executes
+// each instruction and hands it to the model in program order; the model moves
+// it through the IF/ID, ID/EX, EX/MEM and MEM/WB registers one clock cycle at
+// a time, holding it in ID while a source register is not ready on the
+// enabled forwarding paths, and squashing the instructions fetched behind a
+// taken branch or jump when it resolves in EX.
+enum ForwardingPath { FORWARD_EX_EX = 1, FORWARD_MEM_EX = 2 }; // bits of PipelineModel::forwarding
+enum StallCause { STALL_LOAD_USE, STALL_DATA, STALL_ICACHE, STALL_DCACHE, STALL_CAUSES };
+enum ControlKind : uint8_t { CONTROL_NONE, CONTROL_BRANCH, CONTROL_JAL, CONTROL_JALR };
+
+// Contents of a pipeline register; a bubble unless valid
+struct PipelineSlot
+{
+    bool valid = false;
+    uint32_t pc = 0;
+    uint32_t next_pc = 0;          // address of the next instruction in program order
+    uint8_t rd = 0;                // register written, 0 if none
+    uint8_t rs1 = 0, rs2 = 0;      // registers read in EX, 0 if none
+    bool load = false;             // result known only after MEM: loads and atomics
+    uint8_t control = CONTROL_NONE;
+    uint32_t target = 0;           // taken target of a branch or jal
+    bool redirect = false;         // fetch continued down the wrong path behind it
+    int fetch_stall = 0;           // cycles beyond an I-cache hit to fetch it
+    int memory_stall = 0;          // cycles beyond a D-cache hit in MEM
+};
+
+// Branch prediction for the pipeline model (--predictor, --btb, --ras). at
+// fetch the direction predictor guesses conditional branches, the BTB supplies
+// the target of predicted-taken branches and jumps, and the return-address
+// stack that of returns; without a target fetch falls through. predictors are
+// trained with the outcome as soon as the branch is fetched.
+enum PredictorKind { PREDICT_NOT_TAKEN, PREDICT_BTFN, PREDICT_ONE_BIT, PREDICT_TWO_BIT, PREDICT_GSHARE, PREDICT_TOURNAMENT };
+
+// Direction of conditional branches
+class BranchPredictor
+{
+public:
+    virtual ~BranchPredictor() {}
+    virtual bool predict(uint32_t pc, uint32_t target) = 0;
+    virtual void update(uint32_t pc, uint32_t target, bool taken) = 0;
+};
+
+// Returns a predictor of kind with 2^table_bits counters per table (and as many history bits for gshare)
+unique_ptr<BranchPredictor> make_predictor(PredictorKind kind, int table_bits);
+// Parses a --predictor name; false if there is no such predictor
+bool parse_predictor(const string &name, PredictorKind &kind);
+
+struct BtbEntry
+{
+    bool valid = false;
+    uint32_t pc = 0;
+    uint32_t target = 0;
+    uint64_t last_use = 0; // for LRU
+};
+
+struct BranchSite
+{
+    uint8_t control = CONTROL_NONE;
+    long long executed = 0, taken = 0, mispredicted = 0;
+};
+
+class BranchUnit
+{
+public:
+    // btb_entries 0 means no BTB, ras_entries 0 no return-address stack
+    BranchUnit(PredictorKind kind, int table_bits, int btb_entries, int btb_ways, int ras_entries);
+
+    // predicts the instruction fetched after slot; returns true if that is not slot.next_pc
+    bool fetch(const PipelineSlot &slot);
+    void report(ostream &out);
+
+    long long branches = 0, branch_mispredictions = 0; // conditional branches
+    long long jumps = 0, jump_mispredictions = 0;      // jal and jalr
+    long long btb_lookups = 0, btb_hits = 0;
+    long long returns = 0, ras_correct = 0;
+
+private:
+    bool btb_lookup(uint32_t pc, uint32_t &target);
+    void btb_update(uint32_t pc, uint32_t target);
+
+    PredictorKind kind;
+    int table_bits;
+    unique_ptr<BranchPredictor> predictor;
+    int btb_sets, btb_ways;
+    vector<BtbEntry> btb; // btb_sets * btb_ways
+    uint64_t tick = 0;
+    vector<uint32_t> ras; // circular, ras_top entries pushed
+    size_t ras_top = 0;
+    unordered_map<uint32_t, BranchSite> sites;
+};
+
+class PipelineModel
+{
+public:
+    PipelineModel(int forwarding, BranchUnit *branches);
+
+    // clocks the pipeline until it has fetched slot, the next instruction in program order
+    void issue(PipelineSlot slot);
+    // clocks the pipeline until every instruction in it has written back
+    void drain();
+    void report(ostream &out);
+
+    int forwarding;
+    long long cycles = 0;
+    long long instructions = 0;          // written back
+    long long stalls[STALL_CAUSES] = {}; // cycles a stage held its instruction, by cause
+    long long flushes = 0;               // redirects of fetch from EX
+    long long squashed = 0;              // wrong-path fetches thrown away
+
+private:
+    bool clock(const PipelineSlot *next);
+    int hazard(const PipelineSlot &consumer) const;
+
+    BranchUnit *branches;
+    PipelineSlot if_id, id_ex, ex_mem, mem_wb;
+    bool wrong_path = false; // fetching behind a redirect that has not resolved yet
+    int fetch_wait = 0;      // cycles the next instruction has spent in IF on an I-cache miss
+};
+
+// Parses a --forwarding value: on, off, or a comma-separated list of ex-ex and mem-ex
+bool parse_forwarding(const string &paths, int &forwarding);
+
+// Cache simulator (--icache, --dcache, --l2). fetch() sends every instruction
+// fetch to the I-cache and mem() every load, store and atomic to the D-cache;
+// their misses go to the unified L2 when there is one, then to memory. only
+// tags are kept, the data always lives in Memory. misses are classified as
+// compulsory (block never cached before), capacity (a fully associative LRU
+// cache of the same size misses too) or conflict.
+enum ReplacementPolicy { REPLACE_LRU, REPLACE_FIFO, REPLACE_RANDOM };
+// write-back allocates on a write miss; write-through writes every store to
+// the next level and does not allocate. both go through a write buffer, so
+// only fills stall. the L2 is always write-back.
+enum WritePolicy { WRITE_BACK, WRITE_THROUGH };
+enum MissKind { MISS_COMPULSORY, MISS_CAPACITY, MISS_CONFLICT, MISS_KINDS };
+
+const int L2_HIT_LATENCY = 10;        // default cycles for an L1 miss that hits in L2
+const int MAIN_MEMORY_LATENCY = 100;  // default cycles to fetch a block from memory
+
+struct CacheConfig
+{
+    uint32_t size = 0; // bytes, 0 if the cache is not there
+    int ways = 1;
+    int block = 64;    // bytes
+};
+
+struct CacheBlock
+{
+    bool valid = false;
+    bool dirty = false;
+    uint32_t block = 0;    // address / block size
+    uint64_t last_use = 0; // for LRU
+    uint64_t filled = 0;   // for FIFO
+};
+
+struct CacheStats
+{
+    long long reads = 0, writes = 0, hits = 0;
+    long long misses[MISS_KINDS] = {};
+    long long writebacks = 0;     // dirty blocks evicted
+    long long write_throughs = 0; // stores passed on to the next level
+};
+
+class Cache
+{
+public:
+    Cache(const char *name, const CacheConfig &config, ReplacementPolicy replacement, WritePolicy write_policy);
+
+    // Looks up the block holding address; true on a hit. a miss fills the
+    // block unless it is a write that does not allocate. a dirty block evicted
+    // by the fill sets writeback and its address.
+    bool access(uint32_t address, bool write, bool &writeback, uint32_t &writeback_address);
+
+    // misses per access, 0 before the first access
+    double miss_rate() const;
+
+    const char *name;
+    CacheConfig config;
+    WritePolicy write_policy;
+    CacheStats stats;
+
+private:
+    bool shadow_access(uint32_t block, bool allocate);
+
+    ReplacementPolicy replacement;
+    int sets, block_shift;
+    vector<CacheBlock> blocks; // sets * ways
+    uint64_t tick = 0;
+    mt19937 random;            // fixed seed, so runs repeat
+    // for classifying misses: blocks ever cached, and a fully associative LRU cache of the same size
+    unordered_set<uint32_t> cached_before;
+    list<uint32_t> shadow_order; // most recently used first
+    unordered_map<uint32_t, list<uint32_t>::iterator> shadow;
+};
+
+class CacheHierarchy
+{
+public:
+    CacheHierarchy(const CacheConfig &icache, const CacheConfig &dcache, const CacheConfig &l2,
+                   ReplacementPolicy replacement, WritePolicy write_policy, int l2_latency, int memory_latency);
+
+    // return the cycles the access takes beyond an L1 hit
+    int fetch(uint32_t address);
+    int data(uint32_t address, int bytes, bool store);
+    void report(ostream &out, long long instructions);
+
+    unique_ptr<Cache> icache, dcache, l2; // null when not configured
+    long long fetch_stall_cycles = 0, data_stall_cycles = 0;
+
+private:
+    int access(Cache *l1, uint32_t address, bool store);
+    int fill(uint32_t address);
+
+    ReplacementPolicy replacement;
+    int l2_latency, memory_latency;
+};
+
+// Parses SIZE,WAYS,BLOCK_BYTES (SIZE may end in K or M), or off for no cache;
+// false unless the geometry is one the simulator can model
+bool parse_cache_config(const string &text, CacheConfig &config);
+
+// Basic-block vectors for --simpoint. the fast engine ends a block at every
+// branch and jump and adds the instructions it ran to the vector of the
+// current interval, keyed by the address the block started at.
+struct BasicBlockProfile
+{
+    uint32_t block_start = 0;
+    long long block_start_cycle = 0;
+    vector<unordered_map<uint32_t, uint32_t>> intervals = vector<unordered_map<uint32_t, uint32_t>>(1);
+
+    // ends the current block after the instruction counted as cycle; the next one starts at next_pc
+    void end_block(uint32_t next_pc, long long cycle)
+    {
+        intervals.back()[block_start] += cycle - block_start_cycle;
+        block_start = next_pc;
+        block_start_cycle = cycle;
+    }
+};
+
+// A basic block for run_RISCVsim_blocks(): a straight-line run of predecoded
+// instructions that ends at a branch, jal or jalr (or after MAX_BLOCK_OPS).
+struct Block
+{
+    uint32_t start_pc;
+    uint32_t end_pc;                  // address after the last instruction
+    bool valid;                       // cleared when a store overwrites one of its instructions
+    vector<DecodedInstruction> ops;
+    Block *taken = nullptr;           // successor at the branch/jump target
+    Block *fall_through = nullptr;    // successor at end_pc
+    uint32_t rd_mask = 0;             // registers the block writes, for X_written
+    int exec_count = 0;               // executions so far, counted up to JIT_THRESHOLD only
+    uint64_t (*native)(uint32_t *regs) = nullptr; // JIT code: returns next pc | retired << 32
+};
+
+// Result of one micro-op in the block engine
+enum MicroOpResult { OP_NEXT, OP_EXIT, OP_STOP };
+
+// One RV32 hart: the register file, PC, the stage latches and everything an
+// engine keeps between instructions. harts share nothing but their Memory, so
+// independent simulators can run on separate threads.
+class Hart
+{
+public:
+    explicit Hart(Memory &memory);
+    Hart(const Hart &) = delete;
+    Hart &operator=(const Hart &) = delete;
+    ~Hart();
+
+    Memory &memory;
+    int id = 0; // hart number in a multi-hart run
+    PipelineModel *pipeline = nullptr; // timing model run_RISCVsim() feeds, if any
+    CacheHierarchy *caches = nullptr;  // caches fetch() and mem() feed, if any
+    int fetch_stall = 0;               // cycles the last fetch() and mem() spent beyond a cache hit
+    int memory_stall = 0;
+    BasicBlockProfile *profile = nullptr; // basic-block vectors run_RISCVsim_fast() collects, if any
+
+    // Register file - 32 registers (x0 to x31)
+    uint32_t X[32] = {};
+    uint32_t X_written = 0; // bit i is set once write_back() has updated Xi since reset_proc().
+
+    long long clock_cycles = 0; //cycle counter
+
+    uint32_t PC = 0; //program counter
+
+    // data path and control path signal.
+    uint32_t memory_address = 0;
+    int alu_control_signal = -1;
+    int is_mem[2] = {-1, -1}; // this stores the type of memory instruction.
+    bool write_back_signal = false; //write back signal for the mux.
+    bool terminate1 = false;
+    bool halted = false; // the run reached the exit instruction, rather than an error
+    int inc_select = 0; //mux select line
+    int pc_select = 0;  // mux select line
+    uint32_t return_address = 0;
+    int32_t pc_offset = 0;
+
+    uint32_t instruction_word = 0;
+    uint32_t operand1 = 0;
+    uint32_t operand2 = 0;
+    int32_t immediate = 0; // sign-extended immediate of I/S-type instructions
+    const char *operation = "";
+    unsigned int rd = 0;
+    int32_t offset = 0;
+    uint32_t register_data = 0;
+
+    // trace output and binary trace
+    int trace_level = TRACE_STAGE;
+    int trace_stages = TRACE_ALL_STAGES;
+    TraceBuffer trace_buffer;
+    ostream trace_out{&trace_buffer};
+    FILE *binary_trace_file = nullptr;
+    vector<BinaryTraceRecord> binary_trace_buffer;
+
+    // files swi_exit() writes the final memory and registers to, and the part of memory dumped
+    string memory_file = "memory.mc";
+    string register_file = "registerFile.mc";
+    uint32_t dump_start = 0x10000000;
+    uint64_t dump_end = 0x10007FFD;
+    DumpFormat dump_format = DUMP_TEXT;
+
+    volatile long long stop_cycle = NO_STOP_CYCLE;
+    uint32_t stop_pc = NO_STOP_PC;
+
+    // LR/SC reservation: sc.w succeeds if the word still holds the value lr.w read
+    uint32_t reservation_address = NO_RESERVATION;
+    uint32_t reservation_value = 0;
+
+    // block engine and JIT state
+    unordered_map<uint32_t, Block *> block_cache;              // valid blocks by start_pc
+    unordered_map<uint32_t, vector<Block *>> blocks_by_page;   // valid blocks overlapping each page
+    vector<unique_ptr<Block>> block_storage;                   // every block, valid or not; links may still point at invalid ones
+    bool blocks_invalidated = false; // set when a store hits translated code, so the running block stops
+    long long block_lookups = 0;     // block entries that went through block_cache
+    long long block_lookup_hits = 0;
+    long long block_chained = 0;     // block entries that followed a link
+    bool jit_enabled = false;
+    uint8_t *jit_buffer = nullptr;
+    size_t jit_used = 0;
+    long long jit_blocks = 0;
+
+    void run_RISCVsim();
+    void run_RISCVsim_fast();
+    void run_RISCVsim_blocks();
+    void run_RISCVsim_jit();
+    void reset_proc();
+    void load_program_memory(const std::string& file_name);
+    // Loads a .mc file or an RV32 ELF executable; returns false with the reasons in errors
+    bool load_program(const string &file_name, vector<string> &errors);
+    bool load_elf(const char *image, size_t size, vector<string> &errors);
+    void write_data_memory();
+    void swi_exit();
+
+    // Fetches an instruction from memory and updates the instruction register
+    void fetch();
+    // Decodes the instruction, retrieves operands from registers, and determines the execution operation
+    void decode();
+    // Executes the ALU operation as per the decoded instruction
+    void execute();
+    // Handles memory read/write operations
+    void mem();
+    // Writes the final computed result back to the register file
+    void write_back();
+
+    bool parse_trace_option(int argc, char *argv[], int &i);
+    void open_binary_trace(const string &file_name);
+    void close_binary_trace();
+    void record_binary_trace(uint32_t pc);
+    // hands the instruction at pc, just executed, to the pipeline model
+    void pipeline_issue(uint32_t pc);
+    void end_clock_cycle(uint32_t pc);
+    bool at_stop_point();
+    void write_checkpoint(const string &file_name);
+    void restore_checkpoint(const string &file_name);
+    void invalidate_blocks(uint32_t address);
+
+private:
+    bool trace_on(int stage)
+    {
+        return trace_level == TRACE_STAGE && (trace_stages & stage);
+    }
+
+    bool checkShiftAmount(uint32_t amount);
+    bool checkAtomicAlignment(uint32_t address);
+    uint32_t atomic_memory_operation(int op, uint32_t address, uint32_t value);
+    void setMemoryAccess(uint32_t address, int accessType, int width);
+    void logBinaryOperation();
+    void logAddressOperation();
+    void logShiftOperation(uint32_t value, bool withAdd = false);
+
+    const DecodedInstruction *fetch_decoded(uint32_t pc);
+    Block *lookup_block(uint32_t pc);
+    MicroOpResult execute_micro_op(const DecodedInstruction &d, uint32_t &pc);
+    bool jit_compile(Block *b);
+};
 
+// utility: to convert a 32-bit value to "0x" followed by 8 lowercase hex digits
+string nhex(uint32_t num);
 
-// Fetches an instruction from memory and updates the instruction register
-void fetch();
-// Decodes the instruction, retrieves operands from registers, and determines the execution operation  
-void decode();
-// Executes the ALU operation as per the decoded instruction  
-void execute();
-// Handles memory read/write operations  
-void mem();
-// Writes the final computed result back to the register file  
-void write_back();
+// --serve: answers JSON line requests on stdin/stdout, or on the Unix socket
+// socket_path when it is not empty, until "quit" or the end of the input
+int serve(const string &socket_path, int trace_level, int trace_stages);
 
+// --sweep: times program under every configuration of the grid in grid_file on
+// `threads` threads and writes a CSV row per configuration to output_file
+int run_sweep(const string &grid_file, const string &program, int threads, const string &output_file);
 
-// Writes an instruction to memory at a specified address  
-void write_word(const std::string& address, const std::string& instruction);
+// --simpoint: runs hart's program to the end in the fast engine, collecting a
+// basic-block vector every interval instructions, clusters the intervals into
+// at most max_clusters phases and times one interval per phase on the models
+// attached to hart, after warmup instructions of warm-up. prints the points
+// and the CPI they extrapolate to.
+void run_simpoints(Hart &hart, int interval, int max_clusters, int warmup, ostream &out);
 
+#endif
@@ -0,0 +1,256 @@
+/* cache.cpp
+   Cache simulator (--icache, --dcache, --l2): set-associative caches with
+   LRU, FIFO or random replacement, write-back or write-through L1 data
+   caches, an optional unified L2, and the three-C classification of misses.
+   Only tags are simulated; the hierarchy returns the cycles each access costs
+   beyond an L1 hit, which the pipeline model turns into IF and MEM stalls.
+*/
+
+#include "../include/myARMSim.h"
+
+Cache::Cache(const char *name, const CacheConfig &config, ReplacementPolicy replacement, WritePolicy write_policy)
+    : name(name), config(config), write_policy(write_policy), replacement(replacement),
+      sets(config.size / (config.ways * config.block)), blocks(static_cast<size_t>(sets) * config.ways), random(1)
+{
+    block_shift = 0;
+    while ((1 << block_shift) < config.block)
+    {
+        block_shift++;
+    }
+}
+
+// Looks block up in the fully associative LRU shadow; returns true on a hit
+bool Cache::shadow_access(uint32_t block, bool allocate)
+{
+    auto found = shadow.find(block);
+    if (found != shadow.end())
+    {
+        shadow_order.splice(shadow_order.begin(), shadow_order, found->second);
+        return true;
+    }
+    if (allocate)
+    {
+        if (shadow_order.size() == blocks.size())
+        {
+            shadow.erase(shadow_order.back());
+            shadow_order.pop_back();
+        }
+        shadow_order.push_front(block);
+        shadow[block] = shadow_order.begin();
+    }
+    return false;
+}
+
+bool Cache::access(uint32_t address, bool write, bool &writeback, uint32_t &writeback_address)
+{
+    uint32_t block = address >> block_shift;
+    CacheBlock *set = &blocks[(block % sets) * config.ways];
+    bool allocate = !write || write_policy == WRITE_BACK;
+    writeback = false;
+    (write ? stats.writes : stats.reads)++;
+    tick++;
+
+    bool shadow_hit = shadow_access(block, allocate);
+    for (int w = 0; w < config.ways; w++)
+    {
+        if (set[w].valid && set[w].block == block)
+        {
+            stats.hits++;
+            set[w].last_use = tick;
+            set[w].dirty |= (write && write_policy == WRITE_BACK);
+            return true;
+        }
+    }
+
+    MissKind kind = !cached_before.count(block) ? MISS_COMPULSORY : !shadow_hit ? MISS_CAPACITY : MISS_CONFLICT;
+    stats.misses[kind]++;
+    if (!allocate)
+    {
+        return false;
+    }
+    cached_before.insert(block);
+
+    // a free way, else the victim the policy picks
+    CacheBlock *victim = nullptr;
+    for (int w = 0; w < config.ways && !victim; w++)
+    {
+        victim = set[w].valid ? nullptr : &set[w];
+    }
+    if (!victim && replacement == REPLACE_RANDOM)
+    {
+        victim = &set[random() % config.ways];
+    }
+    if (!victim)
+    {
+        victim = &set[0];
+        for (int w = 1; w < config.ways; w++)
+        {
+            uint64_t age = (replacement == REPLACE_LRU) ? set[w].last_use : set[w].filled;
+            uint64_t oldest = (replacement == REPLACE_LRU) ? victim->last_use : victim->filled;
+            victim = (age < oldest) ? &set[w] : victim;
+        }
+    }
+    if (victim->valid && victim->dirty)
+    {
+        stats.writebacks++;
+        writeback = true;
+        writeback_address = victim->block << block_shift;
+    }
+    victim->valid = true;
+    victim->dirty = write;
+    victim->block = block;
+    victim->last_use = tick;
+    victim->filled = tick;
+    return false;
+}
+
+double Cache::miss_rate() const
+{
+    long long accesses = stats.reads + stats.writes;
+    return accesses ? static_cast<double>(accesses - stats.hits) / accesses : 0.0;
+}
+
+CacheHierarchy::CacheHierarchy(const CacheConfig &icache_config, const CacheConfig &dcache_config, const CacheConfig &l2_config,
+                               ReplacementPolicy replacement, WritePolicy write_policy, int l2_latency, int memory_latency)
+    : replacement(replacement), l2_latency(l2_latency), memory_latency(memory_latency)
+{
+    if (icache_config.size)
+    {
+        icache.reset(new Cache("I-cache", icache_config, replacement, WRITE_BACK));
+    }
+    if (dcache_config.size)
+    {
+        dcache.reset(new Cache("D-cache", dcache_config, replacement, write_policy));
+    }
+    if (l2_config.size)
+    {
+        l2.reset(new Cache("L2", l2_config, replacement, WRITE_BACK));
+    }
+}
+
+// Cycles to bring the block holding address into an L1
+int CacheHierarchy::fill(uint32_t address)
+{
+    if (!l2)
+    {
+        return memory_latency;
+    }
+    bool writeback;
+    uint32_t writeback_address;
+    return l2->access(address, false, writeback, writeback_address) ? l2_latency : l2_latency + memory_latency;
+}
+
+int CacheHierarchy::access(Cache *l1, uint32_t address, bool store)
+{
+    bool writeback;
+    uint32_t writeback_address;
+    bool hit = l1->access(address, store, writeback, writeback_address);
+
+    // evicted dirty blocks and write-through stores go to the next level through the write buffer
+    bool ignored;
+    uint32_t ignored_address;
+    if (writeback && l2)
+    {
+        l2->access(writeback_address, true, ignored, ignored_address);
+    }
+    if (store && l1->write_policy == WRITE_THROUGH)
+    {
+        l1->stats.write_throughs++;
+        if (l2)
+        {
+            l2->access(address, true, ignored, ignored_address);
+        }
+    }
+
+    bool filled = !hit && (!store || l1->write_policy == WRITE_BACK);
+    return filled ? fill(address) : 0;
+}
+
+int CacheHierarchy::fetch(uint32_t address)
+{
+    int stall = icache ? access(icache.get(), address, false) : 0;
+    fetch_stall_cycles += stall;
+    return stall;
+}
+
+int CacheHierarchy::data(uint32_t address, int bytes, bool store)
+{
+    if (!dcache)
+    {
+        return 0;
+    }
+    // an access that straddles blocks touches each of them
+    uint32_t block = dcache->config.block;
+    uint32_t last = (address + bytes - 1) & ~(block - 1);
+    int stall = 0;
+    for (uint32_t at = address & ~(block - 1);; at += block)
+    {
+        stall += access(dcache.get(), (at < address) ? address : at, store);
+        if (at == last)
+        {
+            break;
+        }
+    }
+    data_stall_cycles += stall;
+    return stall;
+}
+
+// Prints a row per cache and the memory stall cycles they cost
+void CacheHierarchy::report(ostream &out, long long instructions)
+{
+    static const char *const replacement_names[] = {"LRU", "FIFO", "random"};
+    char line[256];
+    snprintf(line, sizeof(line), "Caches: %s replacement, %s L1 data cache, L2 hit %d cycles, memory %d cycles\n",
+             replacement_names[replacement],
+             (dcache && dcache->write_policy == WRITE_THROUGH) ? "write-through" : "write-back",
+             l2_latency, memory_latency);
+    out << line;
+    snprintf(line, sizeof(line), "%-8s %8s %4s %5s %10s %10s %9s %8s %10s %9s %9s %10s\n", "Cache", "Size", "Ways", "Block",
+             "Accesses", "Hits", "Misses", "MissRate", "Compulsory", "Capacity", "Conflict", "Writebacks");
+    out << line;
+    for (Cache *c : {icache.get(), dcache.get(), l2.get()})
+    {
+        if (!c)
+        {
+            continue;
+        }
+        const CacheStats &s = c->stats;
+        long long accesses = s.reads + s.writes;
+        snprintf(line, sizeof(line), "%-8s %8u %4d %5d %10lld %10lld %9lld %7.2f%% %10lld %9lld %9lld %10lld\n",
+                 c->name, c->config.size, c->config.ways, c->config.block, accesses, s.hits, accesses - s.hits,
+                 100.0 * c->miss_rate(), s.misses[MISS_COMPULSORY], s.misses[MISS_CAPACITY],
+                 s.misses[MISS_CONFLICT], s.writebacks);
+        out << line;
+    }
+    if (dcache && dcache->write_policy == WRITE_THROUGH)
+    {
+        out << "Stores written through: " << dcache->stats.write_throughs << '\n';
+    }
+
+    // without the pipeline model every stall cycle adds to one cycle per instruction
+    long long stalls = fetch_stall_cycles + data_stall_cycles;
+    snprintf(line, sizeof(line), "Memory stall cycles: %lld fetch, %lld data, estimated CPI %.2f without overlap\n",
+             fetch_stall_cycles, data_stall_cycles, instructions ? 1.0 + static_cast<double>(stalls) / instructions : 0.0);
+    out << line;
+    out.flush();
+}
+
+bool parse_cache_config(const string &text, CacheConfig &config)
+{
+    if (text == "off")
+    {
+        config = CacheConfig();
+        return true;
+    }
+    char unit = 0;
+    unsigned size;
+    int n = sscanf(text.c_str(), "%u%c,%d,%d", &size, &unit, &config.ways, &config.block);
+    if (n < 3 || (unit != 'K' && unit != 'k' && unit != 'M' && unit != 'm'))
+    {
+        unit = 0;
+        n = sscanf(text.c_str(), "%u,%d,%d", &size, &config.ways, &config.block) + 1;
+    }
+    config.size = size << ((unit == 'K' || unit == 'k') ? 10 : (unit == 'M' || unit == 'm') ? 20 : 0);
+    return n == 4 && config.size > 0 && config.ways >= 1 && config.block >= 4 && !(config.block & (config.block - 1)) &&
+           config.size % (config.ways * config.block) == 0;
+}
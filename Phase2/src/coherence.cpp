@@ -0,0 +1,248 @@
+/* coherence.cpp
+   MESI coherence timing model for multi-hart runs (--coherence). Each hart
+   has a private set-associative L1 data cache with LRU replacement, kept
+   coherent over a snooping bus or a directory. Hart::mem() reports every
+   data access; the model counts hits, misses, invalidations and the stall
+   cycles they cost, and finds the lines that are falsely shared.
+*/
+
+#include "../include/myARMSim.h"
+
+CoherenceModel::CoherenceModel(int cores, CoherenceProtocol protocol, int sets, int ways, int line_size)
+    : protocol(protocol), cores(cores), sets(sets), ways(ways),
+      lines(static_cast<size_t>(cores) * sets * ways), stats(cores), lost(cores)
+{
+    line_shift = 0;
+    while ((1 << line_shift) < line_size)
+    {
+        line_shift++;
+    }
+}
+
+// Returns core's copy of line, or nullptr if it holds none
+CacheLine *CoherenceModel::find(int core, uint32_t line)
+{
+    CacheLine *set = &lines[(static_cast<size_t>(core) * sets + line % sets) * ways];
+    for (int w = 0; w < ways; w++)
+    {
+        if (set[w].state != MESI_INVALID && set[w].line == line)
+        {
+            return &set[w];
+        }
+    }
+    return nullptr;
+}
+
+// Picks the way line goes to in core's cache: a free one, or the least recently used
+CacheLine *CoherenceModel::allocate(int core, uint32_t line)
+{
+    CacheLine *set = &lines[(static_cast<size_t>(core) * sets + line % sets) * ways];
+    CacheLine *victim = &set[0];
+    for (int w = 0; w < ways; w++)
+    {
+        if (set[w].state == MESI_INVALID)
+        {
+            victim = &set[w];
+            break;
+        }
+        if (set[w].last_use < victim->last_use)
+        {
+            victim = &set[w];
+        }
+    }
+    if (victim->state == MESI_MODIFIED)
+    {
+        stats[core].writebacks++;
+    }
+    *victim = CacheLine();
+    victim->line = line;
+    return victim;
+}
+
+// Invalidates every other copy of line before core writes the bytes in mask.
+// returns the number of copies invalidated.
+int CoherenceModel::invalidate_others(int core, uint32_t line, uint64_t mask)
+{
+    int count = 0;
+    for (int k = 0; k < cores; k++)
+    {
+        CacheLine *c = (k == core) ? nullptr : find(k, line);
+        if (!c)
+        {
+            continue;
+        }
+        LineHotspot &spot = hotspots[line];
+        spot.invalidations++;
+        if ((c->accessed & mask) == 0)
+        {
+            spot.false_sharing++;
+        }
+        c->state = MESI_INVALID;
+        lost[k].insert(line);
+        stats[k].invalidations_received++;
+        stats[core].invalidations_sent++;
+        count++;
+    }
+    return count;
+}
+
+void CoherenceModel::access(int core, uint32_t address, int bytes, bool store)
+{
+    lock_guard<mutex> guard(lock);
+
+    // an access that straddles two lines touches both
+    uint32_t line_size = 1u << line_shift;
+    while (bytes > 0)
+    {
+        uint32_t offset = address & (line_size - 1);
+        int count = min<int>(bytes, line_size - offset);
+        uint64_t mask = ((count == 64) ? ~0ULL : ((1ULL << count) - 1)) << offset;
+        access_line(core, address >> line_shift, mask, store);
+        address += count;
+        bytes -= count;
+    }
+}
+
+void CoherenceModel::access_line(int core, uint32_t line, uint64_t mask, bool store)
+{
+    CoherenceStats &s = stats[core];
+    (store ? s.stores : s.loads)++;
+
+    CacheLine *c = find(core, line);
+    int latency = L1_HIT_LATENCY;
+    int coherence = 0;
+
+    if (c && (!store || c->state != MESI_SHARED))
+    {
+        // hit; a store to an exclusive line needs nobody else
+        s.hits++;
+        if (store)
+        {
+            c->state = MESI_MODIFIED;
+        }
+    }
+    else if (c)
+    {
+        // store to a shared line: upgrade to modified, invalidating the other copies
+        s.upgrades++;
+        int invalidated = invalidate_others(core, line, mask);
+        if (protocol == COHERENCE_BUS)
+        {
+            latency += BUS_LATENCY;
+            transactions++;
+        }
+        else
+        {
+            // request to the directory, which sends invalidations and collects the acks
+            latency += DIRECTORY_LATENCY + (invalidated ? 2 * NETWORK_HOP_LATENCY : 0);
+            transactions += 2 + 2 * invalidated;
+        }
+        coherence = latency - L1_HIT_LATENCY;
+        c->state = MESI_MODIFIED;
+    }
+    else
+    {
+        // miss: the line comes from another L1 when one holds it, otherwise from memory
+        s.misses++;
+        bool coherence_miss = lost[core].erase(line) > 0;
+        if (coherence_miss)
+        {
+            s.coherence_misses++;
+        }
+
+        bool held = false;
+        for (int k = 0; k < cores; k++)
+        {
+            CacheLine *other = (k == core) ? nullptr : find(k, line);
+            if (other)
+            {
+                held = true;
+                if (!store && other->state != MESI_SHARED)
+                {
+                    // the owner keeps a shared copy, flushing it if it was modified
+                    if (other->state == MESI_MODIFIED)
+                    {
+                        stats[k].writebacks++;
+                    }
+                    other->state = MESI_SHARED;
+                }
+            }
+        }
+        int invalidated = store ? invalidate_others(core, line, mask) : 0;
+
+        if (protocol == COHERENCE_BUS)
+        {
+            latency += BUS_LATENCY + (held ? CACHE_TO_CACHE_LATENCY : MEMORY_LATENCY);
+            transactions++;
+        }
+        else
+        {
+            // request and reply, plus a forward to the owner and the invalidation round trips
+            latency += DIRECTORY_LATENCY + (held ? 2 * NETWORK_HOP_LATENCY + CACHE_TO_CACHE_LATENCY : MEMORY_LATENCY);
+            transactions += 2 + (held ? 1 : 0) + 2 * invalidated;
+        }
+        if (coherence_miss)
+        {
+            coherence = latency - L1_HIT_LATENCY;
+        }
+        else if (invalidated)
+        {
+            coherence = (protocol == COHERENCE_BUS) ? 0 : 2 * NETWORK_HOP_LATENCY;
+        }
+
+        c = allocate(core, line);
+        c->state = store ? MESI_MODIFIED : held ? MESI_SHARED : MESI_EXCLUSIVE;
+    }
+
+    c->accessed |= mask;
+    c->last_use = ++tick;
+    s.stall_cycles += latency - L1_HIT_LATENCY;
+    s.coherence_stall_cycles += coherence;
+}
+
+// Prints the per-hart counters, the stall cycles with the CPI they give on
+// top of one cycle per instruction, and the most invalidated lines.
+void CoherenceModel::report(ostream &out, const vector<long long> &instructions)
+{
+    lock_guard<mutex> guard(lock);
+
+    char line[256];
+    snprintf(line, sizeof(line), "Coherence: MESI over a %s, %d x %d-way x %d-byte L1 data caches\n",
+             protocol == COHERENCE_BUS ? "snooping bus" : "directory", sets, ways, 1 << line_shift);
+    out << line;
+    snprintf(line, sizeof(line), "%4s %10s %10s %10s %9s %9s %9s %9s %9s %9s %11s %11s %6s\n", "Hart", "Loads", "Stores",
+             "Hits", "Misses", "CohMiss", "Upgrades", "InvSent", "InvRecv", "Writeback", "Stall", "CohStall", "CPI");
+    out << line;
+    for (int k = 0; k < cores; k++)
+    {
+        const CoherenceStats &s = stats[k];
+        long long count = (k < static_cast<int>(instructions.size())) ? instructions[k] : 0;
+        double cpi = count ? static_cast<double>(count + s.stall_cycles) / count : 0.0;
+        snprintf(line, sizeof(line), "%4d %10lld %10lld %10lld %9lld %9lld %9lld %9lld %9lld %9lld %11lld %11lld %6.2f\n",
+                 k, s.loads, s.stores, s.hits, s.misses, s.coherence_misses, s.upgrades, s.invalidations_sent,
+                 s.invalidations_received, s.writebacks, s.stall_cycles, s.coherence_stall_cycles, cpi);
+        out << line;
+    }
+    out << (protocol == COHERENCE_BUS ? "Bus transactions: " : "Directory messages: ") << transactions << '\n';
+
+    // the ten lines invalidated most often
+    vector<pair<uint32_t, LineHotspot>> ranked(hotspots.begin(), hotspots.end());
+    sort(ranked.begin(), ranked.end(), [](const pair<uint32_t, LineHotspot> &a, const pair<uint32_t, LineHotspot> &b) {
+        return a.second.invalidations != b.second.invalidations ? a.second.invalidations > b.second.invalidations : a.first < b.first;
+    });
+    if (ranked.empty())
+    {
+        out << "No invalidations" << '\n';
+    }
+    else
+    {
+        out << "Most invalidated lines (false sharing: the writer did not touch the bytes the copy had used):" << '\n';
+    }
+    for (size_t i = 0; i < ranked.size() && i < 10; i++)
+    {
+        snprintf(line, sizeof(line), "  %s  invalidations %lld  false sharing %lld\n",
+                 nhex(ranked[i].first << line_shift).c_str(), ranked[i].second.invalidations, ranked[i].second.false_sharing);
+        out << line;
+    }
+    out.flush();
+}
@@ -5,6 +5,7 @@ import os
 import sys
 import re
 import time
+import json
 
 class RISCVSimulatorGUI:
     def __init__(self, root):
@@ -19,12 +20,23 @@ class RISCVSimulatorGUI:
         # Current file path
         self.current_file = None
         self.simulation_running = False
+
+        # myRISCVSim --serve, started on first use and kept for the whole session
+        self.server = None
+
+        # What the views show: updated from the deltas of each step and run
+        self.pc = 0
+        self.registers = [0] * 32
+        self.memory_words = {}  # non-zero words of the data segment by address
         
         # Create main frames
         self.create_menu()
         self.create_toolbar()
         self.create_main_area()
         self.create_status_bar()
+        if self.cpp_executable:
+            self.status_bar.config(text=f"Using simulator: {os.path.basename(self.cpp_executable)}")
+        self.root.protocol("WM_DELETE_WINDOW", self.close)
     
     def setup_paths(self):
         # Path to the C++ executable - adjust this based on your build setup
@@ -46,6 +58,7 @@ class RISCVSimulatorGUI:
         
         search_paths = [
             self.base_path,
+            os.path.join(self.base_path, "..", "bin"),
             os.path.join(self.base_path, ".."),
             os.path.join(self.base_path, "build"),
             os.path.join(self.base_path, "..", "build")
@@ -57,7 +70,6 @@ class RISCVSimulatorGUI:
                     executable = os.path.join(path, name + ext)
                     if os.path.isfile(executable) and os.access(executable, os.X_OK):
                         self.cpp_executable = executable
-                        self.status_bar.config(text=f"Using simulator: {os.path.basename(executable)}")
                         return
     
     def create_menu(self):
@@ -117,6 +129,9 @@ class RISCVSimulatorGUI:
         load_btn = ttk.Button(toolbar_frame, text="📂 Load Program", command=self.load_program)
         load_btn.pack(side=tk.LEFT, padx=5)
     
+        step_btn = ttk.Button(toolbar_frame, text="⏭️ Step", command=self.step_simulation)
+        step_btn.pack(side=tk.LEFT, padx=5)
+
         run_btn = ttk.Button(toolbar_frame, text="▶️ Run", command=self.run_simulation)
         run_btn.pack(side=tk.LEFT, padx=5)
 
@@ -220,64 +235,78 @@ class RISCVSimulatorGUI:
             except Exception as e:
                 messagebox.showerror("Error", f"Failed to save output: {str(e)}")
     
+    def build_simulator(self):
+        # No simulator binary was found: compile one, once, next to this script
+        self.status_bar.config(text="Compiling the simulator...")
+        self.root.update_idletasks()
+        sources = [os.path.join(self.base_path, name)
+                   for name in ["main.cpp", "myRISCVSim.cpp", "coherence.cpp", "serve.cpp"]]
+        executable = os.path.join(self.base_path, "myRISCVSim")
+        compile_process = subprocess.Popen(["g++", "-O2", "-pthread"] + sources +
+                                           ["-I", os.path.join(self.base_path, "..", "include"), "-o", executable],
+                                           stdout=subprocess.PIPE,
+                                           stderr=subprocess.PIPE)
+        out, err = compile_process.communicate()
+        if compile_process.returncode != 0:
+            self.output_text.delete(1.0, tk.END)
+            self.output_text.insert(tk.END, f"Compilation error:\n{err.decode()}")
+            return False
+        self.cpp_executable = executable
+        return True
+
+    def start_server(self):
+        # Starts myRISCVSim --serve unless it is already running
+        if self.server and self.server.poll() is None:
+            return True
+        if not self.cpp_executable and not self.build_simulator():
+            return False
+        self.server = subprocess.Popen([self.cpp_executable, "--serve"],
+                                       stdin=subprocess.PIPE,
+                                       stdout=subprocess.PIPE,
+                                       text=True,
+                                       bufsize=1)
+        return True
+
+    def request(self, **fields):
+        # Sends one request to the simulator and returns its reply
+        if not self.start_server():
+            raise RuntimeError("the simulator is not available")
+        self.server.stdin.write(json.dumps(fields) + "\n")
+        self.server.stdin.flush()
+        line = self.server.stdout.readline()
+        if not line:
+            self.server = None
+            raise RuntimeError("the simulator exited")
+        reply = json.loads(line)
+        if not reply.get("ok"):
+            raise RuntimeError(reply.get("error", "request failed"))
+        return reply
+
+    def close(self):
+        if self.server and self.server.poll() is None:
+            try:
+                self.request(cmd="quit")
+            except Exception:
+                self.server.kill()
+        self.root.destroy()
+
     def reset_simulation(self):
 
         try:
-            # Create a modified main.cpp file to just reset the processor
-            with open("temp_reset.cpp", "w") as f:
-                f.write("""
-                #include "myRISCVSim.cpp"
-                
-                int main() {
-                    reset_proc();
-                    return 0;
-                }
-                """)
-            
-            # Compile and run the temporary file
-            compile_process = subprocess.Popen(["g++", "temp_reset.cpp", "-o", "temp_reset"],
-                                              stdout=subprocess.PIPE,
-                                              stderr=subprocess.PIPE)
-            out, err = compile_process.communicate()
-            
-            if compile_process.returncode != 0:
-                self.output_text.delete(1.0, tk.END)
-                self.output_text.insert(tk.END, f"Compilation error:\n{err.decode()}")
-                return
-            
-            # Run the compiled program
-            run_process = subprocess.Popen(["./temp_reset"],
-                                         stdout=subprocess.PIPE,
-                                         stderr=subprocess.PIPE)
-            out, err = run_process.communicate()
-            
-            # Alternative approach: modify and run the main executable
-            # process = subprocess.Popen([self.cpp_executable, "--reset"], 
-            #                        stdout=subprocess.PIPE, 
-            #                        stderr=subprocess.PIPE)
-            # out, err = process.communicate()
-            
             self.output_text.delete(1.0, tk.END)
             self.output_text.insert(tk.END, "Processor reset\n")
-            
-            if out:
-                self.output_text.insert(tk.END, out.decode())
-            if err:
-                self.output_text.insert(tk.END, f"Errors:\n{err.decode()}\n")
-            
-            # Clear register and memory displays
-            self.program_text.delete(1.0, tk.END)
-            self.registers_text.delete(1.0, tk.END)
-            self.memory_text.delete(1.0, tk.END)
-            
-            self.status_bar.config(text="Run new program")
-            
-            # Clean up temporary files
-            try:
-                os.remove("temp_reset.cpp")
-                os.remove("temp_reset")
-            except:
-                pass
+
+            # Reload the current program, back at PC 0 with the registers reset
+            if self.current_file:
+                self.request(cmd="reset")
+                self.refresh_registers()
+                self.refresh_memory()
+                self.status_bar.config(text=f"Reset: {os.path.basename(self.current_file)}")
+            else:
+                self.program_text.delete(1.0, tk.END)
+                self.registers_text.delete(1.0, tk.END)
+                self.memory_text.delete(1.0, tk.END)
+                self.status_bar.config(text="Run new program")
             
         except Exception as e:
             messagebox.showerror("Error", f"Failed to reset processor: {str(e)}")
@@ -301,54 +330,32 @@ class RISCVSimulatorGUI:
             return
         
         try:
-            # Create a modified main.cpp file to load the program
-            with open("temp_load.cpp", "w") as f:
-                f.write(f"""
-                #include "myRISCVSim.cpp"
-                
-                int main() {{
-                    reset_proc();
-                    load_program_memory("{self.current_file}");
-                    return 0;
-                }}
-                """)
-            
-            # Compile and run the temporary file
-            compile_process = subprocess.Popen(["g++", "temp_load.cpp", "-o", "temp_load"],
-                                              stdout=subprocess.PIPE,
-                                              stderr=subprocess.PIPE)
-            out, err = compile_process.communicate()
-            
-            if compile_process.returncode != 0:
-                self.output_text.delete(1.0, tk.END)
-                self.output_text.insert(tk.END, f"Compilation error:\n{err.decode()}")
-                return
-            
-            # Run the compiled program
-            run_process = subprocess.Popen(["./temp_load"],
-                                         stdout=subprocess.PIPE,
-                                         stderr=subprocess.PIPE)
-            out, err = run_process.communicate()
+            self.request(cmd="load", file=self.current_file)
                 
             self.output_text.delete(1.0, tk.END)
             self.output_text.insert(tk.END, f"Program loaded: {os.path.basename(self.current_file)}\n")
-            
-            if out:
-                self.output_text.insert(tk.END, out.decode())
-            if err:
-                self.output_text.insert(tk.END, f"Errors:\n{err.decode()}\n")
-            
             self.status_bar.config(text=f"Program loaded: {os.path.basename(self.current_file)}")
-            
-            # Clean up temporary files
-            try:
-                os.remove("temp_load.cpp")
-                os.remove("temp_load")
-            except:
-                pass
+
+            self.refresh_memory()
+            self.refresh_registers()
             
         except Exception as e:
             messagebox.showerror("Error", f"Failed to load program: {str(e)}")
+
+    def step_simulation(self):
+        if not self.current_file:
+            messagebox.showinfo("Info", "Please load a program first.")
+            return
+
+        try:
+            reply = self.request(cmd="step")
+            self.output_text.insert(tk.END, reply["trace"])
+            self.output_text.see(tk.END)
+            self.apply_delta(reply)
+            self.status_bar.config(text=f"PC 0x{reply['pc']:08x}, {reply['cycles']} cycles ({reply['state']})")
+
+        except Exception as e:
+            messagebox.showerror("Error", f"Simulation error: {str(e)}")
     
     def run_simulation(self):
         if not self.current_file:
@@ -357,86 +364,94 @@ class RISCVSimulatorGUI:
         
         try:
             # Update status and output
-            self.status_bar.config(text="Compiling and running main.cpp...")
+            self.status_bar.config(text="Running...")
             self.output_text.delete(1.0, tk.END)
-            self.output_text.insert(tk.END, "Compiling and running main.cpp...\n")
             self.root.update_idletasks()
-            
-            # Compile main.cpp
-            main_cpp_path = os.path.join(self.base_path, "main.cpp")
-            if not os.path.exists(main_cpp_path):
-                self.output_text.insert(tk.END, f"Error: main.cpp not found at {main_cpp_path}\n")
-                return
-                
-            compile_process = subprocess.Popen(["g++", main_cpp_path, "-o", "main"],
-                                            stdout=subprocess.PIPE,
-                                            stderr=subprocess.PIPE)
-            out, err = compile_process.communicate()
-            
-            if compile_process.returncode != 0:
-                self.output_text.insert(tk.END, f"Compilation error:\n{err.decode()}")
-                return
-            
-            # Run the compiled program with the current file as input
-            run_process = subprocess.Popen(["./main", self.current_file],
-                                        stdout=subprocess.PIPE,
-                                        stderr=subprocess.PIPE)
-            out, err = run_process.communicate()
-            
-            # Process output
-            if out:
-                self.output_text.insert(tk.END, out.decode())
-            if err:
-                self.output_text.insert(tk.END, f"Errors:\n{err.decode()}\n")
+
+            # Run from the current state to the end of the program
+            reply = self.request(cmd="run")
+            self.output_text.insert(tk.END, reply["trace"])
             
             self.output_text.insert(tk.END, "Simulation complete\n")
-            self.status_bar.config(text="Simulation complete")
             
-            # Refresh memory and register displays
-            self.refresh_memory()
-            self.refresh_registers()
+            # Update memory and register displays with what the run changed
+            self.apply_delta(reply)
+            self.status_bar.config(text="Simulation complete")
                 
         except Exception as e:
             messagebox.showerror("Error", f"Simulation error: {str(e)}")
+
+    DATA_START = 0x10000000
+    DATA_LENGTH = 0x10000
+
     def refresh_memory(self):
-        # Read memory.mc file
+        # Read the whole data segment, 0x10000000 to 0x1000FFFF
         try:
-            if os.path.exists("memory.mc"):
-                with open("memory.mc", "r") as f:
-                    memory_content = f.read()
-                
-                self.memory_text.delete(1.0, tk.END)
-                self.memory_text.insert(tk.END, "Memory Contents:\n")
-                self.memory_text.insert(tk.END, "-----------------\n")
-                self.memory_text.insert(tk.END, memory_content)
-                
-                self.status_bar.config(text="Memory data refreshed")
-            else:
-                self.memory_text.delete(1.0, tk.END)
-                self.memory_text.insert(tk.END, "Memory file (memory.mc) not found")
+            reply = self.request(cmd="memory", address=self.DATA_START, length=self.DATA_LENGTH)
+            data = bytes.fromhex(reply["bytes"])
+            self.memory_words = {}
+            for offset in range(0, len(data), 4):
+                word = int.from_bytes(data[offset:offset + 4], "little")
+                if word:
+                    self.memory_words[self.DATA_START + offset] = word
+            self.show_memory()
+            self.status_bar.config(text="Memory data refreshed")
         except Exception as e:
             self.memory_text.delete(1.0, tk.END)
             self.memory_text.insert(tk.END, f"Error loading memory data: {str(e)}")
     
     def refresh_registers(self):
-        # Read registerFile.mc file
+        # Read PC and x0..x31
         try:
-            if os.path.exists("registerFile.mc"):
-                with open("registerFile.mc", "r") as f:
-                    register_content = f.read()
-                
-                self.registers_text.delete(1.0, tk.END)
-                self.registers_text.insert(tk.END, "Register Contents:\n")
-                self.registers_text.insert(tk.END, "-----------------\n") 
-                self.registers_text.insert(tk.END, register_content)
-                
-                self.status_bar.config(text="Register data refreshed")
-            else:
-                self.registers_text.delete(1.0, tk.END)
-                self.registers_text.insert(tk.END, "Register file (registerFile.mc) not found")
+            reply = self.request(cmd="registers")
+            self.pc = reply["pc"]
+            self.registers = reply["x"]
+            self.show_registers()
+            self.status_bar.config(text="Register data refreshed")
         except Exception as e:
             self.registers_text.delete(1.0, tk.END)
             self.registers_text.insert(tk.END, f"Error loading register data: {str(e)}")
+
+    def apply_delta(self, reply):
+        # Update the views with the registers and memory words a step or run changed
+        self.pc = reply["pc"]
+        for index, value in reply["delta"]["registers"]:
+            self.registers[index] = value
+        self.show_registers()
+
+        ranges = reply["delta"]["memory"]
+        if any("bytes" not in r for r in ranges):
+            # too much changed to send along; read the data segment again
+            self.refresh_memory()
+            return
+        for r in ranges:
+            data = bytes.fromhex(r["bytes"])
+            for offset in range(0, len(data), 4):
+                address = r["address"] + offset
+                if not self.DATA_START <= address < self.DATA_START + self.DATA_LENGTH:
+                    continue
+                word = int.from_bytes(data[offset:offset + 4], "little")
+                if word:
+                    self.memory_words[address] = word
+                else:
+                    self.memory_words.pop(address, None)
+        if ranges:
+            self.show_memory()
+
+    def show_registers(self):
+        self.registers_text.delete(1.0, tk.END)
+        self.registers_text.insert(tk.END, "Register Contents:\n")
+        self.registers_text.insert(tk.END, "-----------------\n")
+        self.registers_text.insert(tk.END, f"PC 0x{self.pc:08x}\n")
+        for i, value in enumerate(self.registers):
+            self.registers_text.insert(tk.END, f"x{i} 0x{value:08x}\n")
+
+    def show_memory(self):
+        self.memory_text.delete(1.0, tk.END)
+        self.memory_text.insert(tk.END, "Memory Contents:\n")
+        self.memory_text.insert(tk.END, "-----------------\n")
+        lines = [f"0x{address:08x} 0x{word:08x}\n" for address, word in sorted(self.memory_words.items())]
+        self.memory_text.insert(tk.END, "".join(lines))
     
     def show_about(self):
         about_text = """RISC-V Simulator GUI
@@ -3,21 +3,678 @@
 */
 
 #include <bits/stdc++.h>
-#include "myRISCVSim.cpp"
-
 #include "../include/myARMSim.h"
 using namespace std;
 
-int main() {
+Hart *checkpoint_hart = nullptr;
+
+// SIGUSR1 handler: pauses the run at the next instruction so a checkpoint can be taken
+void request_checkpoint(int) {
+    checkpoint_hart->stop_cycle = 0;
+}
+
+// One program of a --batch run
+struct BatchJob {
+    string program;
+    string output_dir;
+    string status = "not run";
+    string error;
+    long long instructions = 0;
+    long long cycles = 0;
+    double seconds = 0;
+};
+
+// Runs every program listed in list_file, one per line, on `threads` worker
+// threads that take the next unstarted job until none are left. each job has
+// its own Memory and Hart and writes memory.mc, registerFile.mc and (unless
+// the trace is off) log.txt to its own directory under output_root.
+int run_batch(const string &list_file, int threads, const string &output_root,
+              const string &engine, int trace_level, int trace_stages) {
+    ifstream list(list_file);
+    if (!list) {
+        cerr << "ERROR: cannot open batch list" << endl;
+        return 1;
+    }
+    vector<BatchJob> jobs;
+    string line;
+    while (getline(list, line)) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        char index[16];
+        snprintf(index, sizeof(index), "%04zu_", jobs.size() + 1);
+        BatchJob job;
+        job.program = line;
+        job.output_dir = output_root + "/" + index + filesystem::path(line).stem().string();
+        jobs.push_back(job);
+    }
+
+    atomic<size_t> next_job(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next_job++) < jobs.size()) {
+            BatchJob &job = jobs[i];
+            auto start = chrono::steady_clock::now();
+            if (!ifstream(job.program)) {
+                job.status = "missing";
+                continue;
+            }
+            filesystem::create_directories(job.output_dir);
+            FILE *log = (trace_level > TRACE_OFF) ? fopen((job.output_dir + "/log.txt").c_str(), "w") : nullptr;
+            {
+                Memory memory;
+                Hart hart(memory);
+                hart.trace_level = trace_level;
+                hart.trace_stages = trace_stages;
+                if (log) {
+                    hart.trace_buffer.out = log;
+                }
+                hart.memory_file = job.output_dir + "/memory.mc";
+                hart.register_file = job.output_dir + "/registerFile.mc";
+
+                hart.reset_proc();
+                vector<string> errors;
+                if (!hart.load_program(job.program, errors)) {
+                    // keep the first problem for the summary and go on to the next job
+                    job.status = "bad load";
+                    job.error = errors.empty() ? "cannot load program" : errors.front();
+                } else if (engine == "fast") {
+                    hart.run_RISCVsim_fast();
+                } else if (engine == "block") {
+                    hart.run_RISCVsim_blocks();
+                } else if (engine == "jit") {
+                    hart.run_RISCVsim_jit();
+                } else {
+                    hart.run_RISCVsim();
+                }
+
+                if (job.error.empty()) {
+                    job.status = hart.halted ? "finished" : "error";
+                    job.instructions = hart.clock_cycles;
+                    job.cycles = hart.clock_cycles;
+                }
+            }
+            if (log) {
+                fclose(log);
+            }
+            job.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int t = 0; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    for (thread &t : pool) {
+        t.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // Summary table
+    long long total_instructions = 0;
+    int failed = 0;
+    printf("%5s  %-8s  %14s  %14s  %10s  %s\n", "Job", "Status", "Instructions", "Cycles", "Wall ms", "Program");
+    for (size_t i = 0; i < jobs.size(); i++) {
+        const BatchJob &job = jobs[i];
+        printf("%5zu  %-8s  %14lld  %14lld  %10.2f  %s\n", i + 1, job.status.c_str(), job.instructions, job.cycles,
+               job.seconds * 1000, job.program.c_str());
+        total_instructions += job.instructions;
+        failed += job.status != "finished";
+    }
+    for (size_t i = 0; i < jobs.size(); i++) {
+        if (!jobs[i].error.empty()) {
+            printf("job %zu: %s: %s\n", i + 1, jobs[i].program.c_str(), jobs[i].error.c_str());
+        }
+    }
+    printf("%zu jobs on %d threads, %d not finished, %lld instructions in %.3f s (%.1f MIPS)\n", jobs.size(), threads,
+           failed, total_instructions, seconds, seconds > 0 ? total_instructions / seconds / 1e6 : 0.0);
+    return failed ? 1 : 0;
+}
+
+// Barrier between the quanta of a threaded multi-hart run. a hart that has
+// ended drops out, so the others no longer wait for it.
+class QuantumBarrier {
+public:
+    explicit QuantumBarrier(int count) : count(count) {}
+
+    void arrive_and_wait() {
+        unique_lock<mutex> guard(lock);
+        int current = generation;
+        if (++arrived == count) {
+            next_generation();
+            return;
+        }
+        released.wait(guard, [&] { return generation != current; });
+    }
+
+    void arrive_and_drop() {
+        lock_guard<mutex> guard(lock);
+        count--;
+        if (arrived > 0 && arrived == count) {
+            next_generation();
+        }
+    }
+
+private:
+    void next_generation() {
+        arrived = 0;
+        generation++;
+        released.notify_all();
+    }
+
+    mutex lock;
+    condition_variable released;
+    int count;
+    int arrived = 0;
+    int generation = 0;
+};
+
+// Runs hart_count harts that share the memory of `hart` and its program. hart i
+// starts at entries[i] (the last entry repeats, the program's entry point if
+// none) with x2 lowered by i * stack_size and its id in x10. every hart runs
+// quantum instructions at a time: round-robin takes the harts in turn on this
+// thread, so a run is always the same; threads gives each hart a host thread
+// and lines them up after every quantum. hart i writes registerFile.mc (hart 0) or registerFile<i>.mc,
+// and memory.mc is written once all of them have ended.
+int run_harts(Hart &hart, const string &program, int hart_count, const vector<uint32_t> &entries,
+              uint32_t stack_size, int quantum, const string &schedule, const string &engine,
+              CoherenceModel *coherence) {
+    Memory &memory = hart.memory;
+    string memory_file = hart.memory_file;
+    hart.load_program_memory(program);
+    // an ELF program sets the entry point, stack and global pointer
+    uint32_t entry = hart.PC, stack_top = hart.X[2], global_pointer = hart.X[3];
+
+    vector<unique_ptr<Hart>> others;
+    vector<Hart *> harts;
+    for (int i = 0; i < hart_count; i++) {
+        Hart *h = &hart;
+        if (i > 0) {
+            others.emplace_back(new Hart(memory));
+            h = others.back().get();
+            h->trace_level = hart.trace_level;
+            h->trace_stages = hart.trace_stages;
+            h->reset_proc();
+        }
+        h->id = i;
+        h->X[2] = stack_top - i * stack_size;
+        h->X[3] = global_pointer;
+        h->X[10] = i;
+        h->PC = entries.empty() ? entry : entries[min<size_t>(i, entries.size() - 1)];
+        h->memory_file = "";
+        h->register_file = (i == 0) ? "registerFile.mc" : "registerFile" + to_string(i) + ".mc";
+        harts.push_back(h);
+    }
+
+    auto run_quantum = [&](int i) {
+        Hart *h = harts[i];
+        if (h->trace_level >= TRACE_INSTRUCTION) {
+            h->trace_out << "Hart " << i << " at clock cycle " << h->clock_cycles << '\n';
+        }
+        h->stop_cycle = stop_cycle_after(h->clock_cycles, quantum);
+        if (engine == "fast") {
+            h->run_RISCVsim_fast();
+        } else {
+            h->run_RISCVsim();
+        }
+        h->trace_out.flush();
+    };
+
+    if (schedule == "threads") {
+        memory.shared = true;
+        QuantumBarrier barrier(hart_count);
+        vector<thread> pool;
+        for (int i = 0; i < hart_count; i++) {
+            pool.emplace_back([&, i]() {
+                while (true) {
+                    run_quantum(i);
+                    if (harts[i]->terminate1) {
+                        barrier.arrive_and_drop();
+                        return;
+                    }
+                    barrier.arrive_and_wait();
+                }
+            });
+        }
+        for (thread &t : pool) {
+            t.join();
+        }
+        memory.shared = false;
+    } else {
+        int running = hart_count;
+        while (running > 0) {
+            for (int i = 0; i < hart_count; i++) {
+                if (!harts[i]->terminate1) {
+                    run_quantum(i);
+                    running -= harts[i]->terminate1;
+                }
+            }
+        }
+    }
+
+    // memory.mc once, from the memory every hart left behind
+    hart.memory_file = memory_file;
+    hart.register_file = "";
+    hart.write_data_memory();
+
+    if (hart.trace_level >= TRACE_SUMMARY) {
+        for (int i = 0; i < hart_count; i++) {
+            hart.trace_out << "Hart " << i << ": " << (harts[i]->halted ? "finished" : "error") << " after "
+                           << harts[i]->clock_cycles << " instructions" << '\n';
+        }
+        hart.trace_out.flush();
+    }
+    if (coherence) {
+        vector<long long> instructions;
+        for (Hart *h : harts) {
+            instructions.push_back(h->clock_cycles);
+        }
+        coherence->report(cout, instructions);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
 
     // Initialize processor state  
-    reset_proc();
-    
-    // Load program instructions into memory  
-    load_program_memory("../test/bubblesort_iterative.mc");
+    Memory memory;
+    Hart hart(memory);
+    hart.reset_proc();
     
+    // Parse options: --engine explain (default, traces every stage), fast, block or jit
+    string program = "../test/bubblesort_iterative.mc";
+    string engine = "explain";
+    string trace_file;
+    // phases: fast_forward instructions (or up to fast_forward_pc) without output,
+    // then a window of detail instructions in the explain engine, then then_fast
+    long long fast_forward = 0;
+    uint32_t fast_forward_pc = NO_STOP_PC;
+    long long detail = -1;
+    bool then_fast = false;
+    // checkpoint_file is written at instruction count checkpoint_at, at checkpoint_pc or on SIGUSR1
+    string checkpoint_file, restore_file;
+    long long checkpoint_at = NO_STOP_CYCLE;
+    uint32_t checkpoint_pc = NO_STOP_PC;
+    // --batch list.txt runs many programs on `threads` threads
+    string batch_file, batch_output = "batch_out";
+    int threads = max(1u, thread::hardware_concurrency());
+    // --harts N runs N harts on one memory, quantum instructions at a time
+    int hart_count = 1;
+    vector<uint32_t> entries;
+    uint32_t stack_size = 0x10000;
+    int quantum = 1000;
+    string schedule = "round-robin";
+    // --coherence bus|directory models private L1 data caches kept coherent with MESI
+    string coherence_protocol;
+    int l1_sets = 64, l1_ways = 8, l1_line = 64;
+    // --sweep grid.json times the program under every configuration of the grid, `threads` at a time
+    string sweep_file, sweep_output = "sweep.csv";
+    // --serve answers JSON requests on stdin, or on the Unix socket given with --socket
+    bool serve_requests = false;
+    string socket_path;
+    // --pipeline times the run on a five-stage pipeline with these forwarding paths
+    bool pipelined = false;
+    int forwarding = FORWARD_EX_EX | FORWARD_MEM_EX;
+    // --predictor picks how fetch guesses branches; a BTB and return-address stack
+    // come with every predictor but not-taken unless --btb and --ras say otherwise
+    PredictorKind predictor = PREDICT_NOT_TAKEN;
+    int predictor_bits = 10, btb_entries = -1, btb_ways = 4, ras_entries = -1;
+    // --icache, --dcache and --l2 simulate a cache hierarchy in front of memory
+    CacheConfig icache_config, dcache_config, l2_config;
+    ReplacementPolicy replacement = REPLACE_LRU;
+    WritePolicy write_policy = WRITE_BACK;
+    int l2_latency = L2_HIT_LATENCY, memory_latency = MAIN_MEMORY_LATENCY;
+    // --simpoint N times only representative intervals of N instructions and extrapolates the CPI
+    int simpoint_interval = 0, simpoint_clusters = 10, warmup = -1;
+    int i = 1;
+    try {
+        for (; i < argc; i++) {
+            string arg = argv[i];
+            if (arg == "--engine" && i + 1 < argc) {
+                engine = argv[++i];
+            } else if (arg == "--trace-file" && i + 1 < argc) {
+                // binary trace of every instruction, read back with mcdump
+                trace_file = argv[++i];
+            } else if (arg == "--fast-forward" && i + 1 < argc) {
+                fast_forward = stoll(argv[++i]);
+            } else if (arg == "--fast-forward-to" && i + 1 < argc) {
+                fast_forward_pc = stoul(argv[++i], nullptr, 0);
+            } else if (arg == "--detail" && i + 1 < argc) {
+                detail = stoll(argv[++i]);
+            } else if (arg == "--then-fast") {
+                then_fast = true;
+            } else if (arg == "--checkpoint" && i + 1 < argc) {
+                checkpoint_file = argv[++i];
+            } else if (arg == "--checkpoint-at" && i + 1 < argc) {
+                checkpoint_at = stoll(argv[++i]);
+            } else if (arg == "--checkpoint-at-pc" && i + 1 < argc) {
+                checkpoint_pc = stoul(argv[++i], nullptr, 0);
+            } else if (arg == "--restore" && i + 1 < argc) {
+                restore_file = argv[++i];
+            } else if (arg == "--batch" && i + 1 < argc) {
+                batch_file = argv[++i];
+            } else if (arg == "--batch-out" && i + 1 < argc) {
+                batch_output = argv[++i];
+            } else if (arg == "-j" && i + 1 < argc) {
+                threads = max(1, stoi(argv[++i]));
+            } else if (arg == "--sweep" && i + 1 < argc) {
+                sweep_file = argv[++i];
+            } else if (arg == "--sweep-out" && i + 1 < argc) {
+                sweep_output = argv[++i];
+            } else if (arg == "--harts" && i + 1 < argc) {
+                hart_count = max(1, stoi(argv[++i]));
+            } else if (arg == "--entry" && i + 1 < argc) {
+                // comma-separated start addresses, one per hart
+                stringstream list(argv[++i]);
+                string entry;
+                while (getline(list, entry, ',')) {
+                    entries.push_back(stoul(entry, nullptr, 0));
+                }
+            } else if (arg == "--stack-size" && i + 1 < argc) {
+                stack_size = stoul(argv[++i], nullptr, 0);
+            } else if (arg == "--quantum" && i + 1 < argc) {
+                quantum = max(1, stoi(argv[++i]));
+            } else if (arg == "--schedule" && i + 1 < argc) {
+                schedule = argv[++i];
+            } else if (arg == "--serve") {
+                serve_requests = true;
+            } else if (arg == "--socket" && i + 1 < argc) {
+                serve_requests = true;
+                socket_path = argv[++i];
+            } else if (arg == "--coherence" && i + 1 < argc) {
+                coherence_protocol = argv[++i];
+            } else if (arg == "--l1" && i + 1 < argc) {
+                // SETS,WAYS,LINE_BYTES
+                if (sscanf(argv[++i], "%d,%d,%d", &l1_sets, &l1_ways, &l1_line) != 3) {
+                    cerr << "ERROR: --l1 takes SETS,WAYS,LINE_BYTES" << endl;
+                    return 1;
+                }
+            } else if (arg == "--pipeline") {
+                pipelined = true;
+            } else if (arg == "--forwarding" && i + 1 < argc) {
+                if (!parse_forwarding(argv[++i], forwarding)) {
+                    cerr << "ERROR: --forwarding takes on, off, ex-ex, mem-ex or ex-ex,mem-ex" << endl;
+                    return 1;
+                }
+            } else if (arg == "--predictor" && i + 1 < argc) {
+                if (!parse_predictor(argv[++i], predictor)) {
+                    cerr << "ERROR: --predictor must be not-taken, btfn, 1bit, 2bit, gshare or tournament" << endl;
+                    return 1;
+                }
+                pipelined = true;
+            } else if (arg == "--predictor-bits" && i + 1 < argc) {
+                predictor_bits = stoi(argv[++i]);
+            } else if (arg == "--btb" && i + 1 < argc) {
+                // ENTRIES[,WAYS]
+                if (sscanf(argv[++i], "%d,%d", &btb_entries, &btb_ways) < 1) {
+                    cerr << "ERROR: --btb takes ENTRIES[,WAYS]" << endl;
+                    return 1;
+                }
+                pipelined = true;
+            } else if (arg == "--ras" && i + 1 < argc) {
+                ras_entries = stoi(argv[++i]);
+                pipelined = true;
+            } else if ((arg == "--icache" || arg == "--dcache" || arg == "--l2") && i + 1 < argc) {
+                CacheConfig &config = (arg == "--icache") ? icache_config : (arg == "--dcache") ? dcache_config : l2_config;
+                if (!parse_cache_config(argv[++i], config)) {
+                    cerr << "ERROR: " << arg << " takes SIZE,WAYS,BLOCK_BYTES with at least one way, a power-of-two "
+                         << "block of at least 4 bytes, and a size that is a multiple of ways * block" << endl;
+                    return 1;
+                }
+            } else if (arg == "--replacement" && i + 1 < argc) {
+                string policy = argv[++i];
+                if (policy != "lru" && policy != "fifo" && policy != "random") {
+                    cerr << "ERROR: --replacement must be lru, fifo or random" << endl;
+                    return 1;
+                }
+                replacement = (policy == "lru") ? REPLACE_LRU : (policy == "fifo") ? REPLACE_FIFO : REPLACE_RANDOM;
+            } else if (arg == "--write-policy" && i + 1 < argc) {
+                string policy = argv[++i];
+                if (policy != "write-back" && policy != "write-through") {
+                    cerr << "ERROR: --write-policy must be write-back or write-through" << endl;
+                    return 1;
+                }
+                write_policy = (policy == "write-back") ? WRITE_BACK : WRITE_THROUGH;
+            } else if (arg == "--l2-latency" && i + 1 < argc) {
+                l2_latency = stoi(argv[++i]);
+            } else if (arg == "--memory-latency" && i + 1 < argc) {
+                memory_latency = stoi(argv[++i]);
+            } else if (arg == "--simpoint" && i + 1 < argc) {
+                simpoint_interval = stoi(argv[++i]);
+                if (simpoint_interval < 1) {
+                    cerr << "ERROR: --simpoint needs an interval of at least one instruction" << endl;
+                    return 1;
+                }
+                pipelined = true;
+            } else if (arg == "--simpoint-k" && i + 1 < argc) {
+                simpoint_clusters = max(1, stoi(argv[++i]));
+            } else if (arg == "--warmup" && i + 1 < argc) {
+                warmup = stoi(argv[++i]);
+            } else if (arg == "--dump-range" && i + 1 < argc) {
+                // START:END of the final memory dump, END excluded, or all of memory
+                string range = argv[++i];
+                size_t colon = range.find(':');
+                if (range == "all") {
+                    hart.dump_start = 0;
+                    hart.dump_end = 0x100000000ULL;
+                } else if (colon != string::npos) {
+                    uint64_t start = stoull(range.substr(0, colon), nullptr, 0);
+                    uint64_t end = stoull(range.substr(colon + 1), nullptr, 0);
+                    if (end > 0x100000000ULL || start > end) {
+                        cerr << "ERROR: --dump-range needs START <= END <= 0x100000000" << endl;
+                        return 1;
+                    }
+                    hart.dump_start = start;
+                    hart.dump_end = end;
+                } else {
+                    cerr << "ERROR: --dump-range takes START:END or all" << endl;
+                    return 1;
+                }
+            } else if (arg == "--dump-format" && i + 1 < argc) {
+                string format = argv[++i];
+                if (format != "text" && format != "binary") {
+                    cerr << "ERROR: --dump-format must be text or binary" << endl;
+                    return 1;
+                }
+                hart.dump_format = (format == "binary") ? DUMP_BINARY : DUMP_TEXT;
+                hart.memory_file = (format == "binary") ? "memory.bin" : "memory.mc";
+            } else if (hart.parse_trace_option(argc, argv, i)) {
+                continue;
+            } else if (arg[0] == '-') {
+                cerr << "ERROR: unknown option " << arg << endl
+                     << "usage: myRISCVSim [OPTIONS] PROGRAM (the options are listed in the README)" << endl;
+                return 1;
+            } else {
+                program = arg;
+            }
+        }
+    } catch (const logic_error &) {
+        // from stoi and the like: the value after argv[i - 1] is not a number or is out of range
+        cerr << "ERROR: " << argv[i - 1] << " takes a number, not \"" << argv[i] << "\"" << endl;
+        return 1;
+    }
+
+    if (!batch_file.empty()) {
+        return run_batch(batch_file, threads, batch_output, engine, hart.trace_level, hart.trace_stages);
+    }
+    if (!sweep_file.empty()) {
+        return run_sweep(sweep_file, program, threads, sweep_output);
+    }
+    if (serve_requests) {
+        return serve(socket_path, hart.trace_level, hart.trace_stages);
+    }
+
+    // the coherence model is fed by mem(), so it runs the explain engine
+    unique_ptr<CoherenceModel> coherence;
+    if (!coherence_protocol.empty()) {
+        if (coherence_protocol != "bus" && coherence_protocol != "directory") {
+            cerr << "ERROR: --coherence must be bus or directory" << endl;
+            return 1;
+        }
+        if (l1_sets < 1 || l1_ways < 1 || l1_line < 1 || l1_line > 64 || (l1_line & (l1_line - 1))) {
+            cerr << "ERROR: --l1 needs at least one set and way, and a power-of-two line of at most 64 bytes" << endl;
+            return 1;
+        }
+        coherence.reset(new CoherenceModel(hart_count, coherence_protocol == "bus" ? COHERENCE_BUS : COHERENCE_DIRECTORY,
+                                           l1_sets, l1_ways, l1_line));
+        memory.coherence = coherence.get();
+        engine = "explain";
+    }
+
+    // the pipeline model is fed by run_RISCVsim(), so it runs the explain engine as well
+    unique_ptr<BranchUnit> branch_unit;
+    unique_ptr<PipelineModel> pipeline;
+    if (pipelined) {
+        bool dynamic = (predictor != PREDICT_NOT_TAKEN);
+        btb_entries = (btb_entries < 0) ? (dynamic ? 512 : 0) : btb_entries;
+        ras_entries = (ras_entries < 0) ? (dynamic ? 8 : 0) : ras_entries;
+        if (predictor_bits < 1 || predictor_bits > 24 || btb_entries < 0 || btb_ways < 1 || ras_entries < 0) {
+            cerr << "ERROR: --predictor-bits must be 1 to 24, --btb needs at least one way, --ras at least 0 entries" << endl;
+            return 1;
+        }
+        branch_unit.reset(new BranchUnit(predictor, predictor_bits, btb_entries, btb_ways, ras_entries));
+        pipeline.reset(new PipelineModel(forwarding, branch_unit.get()));
+        hart.pipeline = pipeline.get();
+        engine = "explain";
+    }
+
+    // the caches are fed by fetch() and mem(), which only the explain engine calls
+    unique_ptr<CacheHierarchy> caches;
+    if (icache_config.size || dcache_config.size || l2_config.size) {
+        if (!icache_config.size && !dcache_config.size) {
+            cerr << "ERROR: --l2 needs --icache or --dcache in front of it" << endl;
+            return 1;
+        }
+        if (l2_latency < 0 || memory_latency < 0) {
+            cerr << "ERROR: --l2-latency and --memory-latency cannot be negative" << endl;
+            return 1;
+        }
+        caches.reset(new CacheHierarchy(icache_config, dcache_config, l2_config, replacement, write_policy,
+                                        l2_latency, memory_latency));
+        hart.caches = caches.get();
+        engine = "explain";
+    }
+
+    if (simpoint_interval) {
+        warmup = (warmup < 0) ? simpoint_interval : warmup;
+        if (coherence || !trace_file.empty() || detail >= 0) {
+            cerr << "ERROR: --simpoint does not combine with --coherence, --trace-file or --detail" << endl;
+            return 1;
+        }
+    }
+
+    if (hart_count > 1 || !entries.empty()) {
+        if (pipeline) {
+            cerr << "ERROR: --pipeline times a single hart" << endl;
+            return 1;
+        }
+        if (caches) {
+            cerr << "ERROR: --icache, --dcache and --l2 simulate a single hart; use --coherence for several" << endl;
+            return 1;
+        }
+        if (!trace_file.empty() || !checkpoint_file.empty() || !restore_file.empty() ||
+            fast_forward > 0 || fast_forward_pc != NO_STOP_PC || detail >= 0) {
+            cerr << "ERROR: --harts does not combine with --trace-file, checkpoints or phases" << endl;
+            return 1;
+        }
+        if (schedule != "round-robin" && schedule != "threads") {
+            cerr << "ERROR: --schedule must be round-robin or threads" << endl;
+            return 1;
+        }
+        // the block and jit engines cannot stop at the end of a quantum
+        if (engine == "block" || engine == "jit") {
+            cerr << "WARNING: --harts runs the fast engine instead of " << engine << endl;
+            engine = "fast";
+        }
+        return run_harts(hart, program, hart_count, entries, stack_size, quantum, schedule, engine, coherence.get());
+    }
+
+    // Load program instructions into memory, or the state saved in a checkpoint
+    if (!restore_file.empty()) {
+        hart.restore_checkpoint(restore_file);
+    } else {
+        hart.load_program_memory(program);
+    }
+
+    // Run up to the checkpoint in the fast engine and save the state there
+    if (!checkpoint_file.empty()) {
+        checkpoint_hart = &hart;
+        signal(SIGUSR1, request_checkpoint);
+        hart.stop_cycle = checkpoint_at;
+        hart.stop_pc = checkpoint_pc;
+        hart.run_RISCVsim_fast();
+        hart.stop_cycle = NO_STOP_CYCLE;
+        hart.stop_pc = NO_STOP_PC;
+        signal(SIGUSR1, SIG_DFL);
+        if (hart.terminate1) {
+            cerr << "WARNING: the program ended before the checkpoint was taken" << endl;
+        } else {
+            hart.write_checkpoint(checkpoint_file);
+        }
+    }
+
+    // Skip ahead silently in the fast engine; the state carries over to the next phase
+    if (fast_forward > 0 || fast_forward_pc != NO_STOP_PC) {
+        hart.stop_cycle = (fast_forward > 0) ? stop_cycle_after(hart.clock_cycles, fast_forward) : NO_STOP_CYCLE;
+        hart.stop_pc = fast_forward_pc;
+        hart.run_RISCVsim_fast();
+        hart.stop_cycle = NO_STOP_CYCLE;
+        hart.stop_pc = NO_STOP_PC;
+        engine = "explain";
+    }
+
+    // the binary trace is recorded by the five-stage engine, from the current state
+    if (!trace_file.empty()) {
+        hart.open_binary_trace(trace_file);
+        engine = "explain";
+    }
+    if (detail >= 0) {
+        engine = "explain";
+    }
+
+    // Profile the whole run in the fast engine, then time the simulation points
+    if (simpoint_interval && !hart.terminate1) {
+        run_simpoints(hart, simpoint_interval, simpoint_clusters, warmup, cout);
+    }
+
     // Run the simulator
-    run_RISCVsim();
+    if (hart.terminate1) {
+        // the program ended while fast-forwarding or profiling
+    } else if (engine == "fast") {
+        hart.run_RISCVsim_fast();
+    } else if (engine == "block") {
+        hart.run_RISCVsim_blocks();
+    } else if (engine == "jit") {
+        hart.run_RISCVsim_jit();
+    } else {
+        hart.stop_cycle = (detail >= 0) ? stop_cycle_after(hart.clock_cycles, detail) : NO_STOP_CYCLE;
+        if (detail != 0) {
+            hart.run_RISCVsim();
+        }
+        hart.stop_cycle = NO_STOP_CYCLE;
+
+        // after the detail window, finish in the fast engine or end the run here
+        if (!hart.terminate1) {
+            if (then_fast) {
+                hart.run_RISCVsim_fast();
+            } else {
+                hart.swi_exit();
+            }
+        }
+    }
+
+    if (coherence) {
+        coherence->report(cout, {hart.clock_cycles});
+    }
+    if (pipeline) {
+        pipeline->report(cout);
+    }
+    if (caches) {
+        caches->report(cout, hart.clock_cycles);
+    }
     
     return 0;
 }
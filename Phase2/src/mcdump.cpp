@@ -0,0 +1,100 @@
+/* mcdump.cpp
+   Expands a binary trace written with --trace-file back into the text trace.
+   Each record is replayed through the simulator's own stage functions: the
+   register file comes from the trace header and the values of loads come
+   from the records, so the FETCH/DECODE/EXECUTE/MEMORY/WRITEBACK lines are
+   the ones the original run would have printed.
+*/
+
+#include <bits/stdc++.h>
+#include "../include/myARMSim.h"
+using namespace std;
+
+int main(int argc, char *argv[]) {
+
+    // Parse options: the trace file, plus the --trace and --trace-stages options of the simulator
+    Memory memory;
+    Hart hart(memory);
+    string trace_file;
+    for (int i = 1; i < argc; i++) {
+        if (!hart.parse_trace_option(argc, argv, i)) {
+            trace_file = argv[i];
+        }
+    }
+    if (trace_file.empty()) {
+        cerr << "usage: mcdump TRACE_FILE [--trace LEVEL] [--trace-stages LIST]" << endl;
+        return 1;
+    }
+
+    FILE *in = fopen(trace_file.c_str(), "rb");
+    if (!in) {
+        cerr << "ERROR: cannot open trace file" << endl;
+        return 1;
+    }
+
+    BinaryTraceHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, BINARY_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.record_size != sizeof(BinaryTraceRecord)) {
+        cerr << "ERROR: " << trace_file << " is not a binary trace" << endl;
+        return 1;
+    }
+
+    // Start from the processor state the trace was recorded from
+    hart.reset_proc();
+    memcpy(hart.X, header.X, sizeof(hart.X));
+    hart.X_written = header.X_written;
+    hart.clock_cycles = header.clock_cycles;
+    // a record that fails to decode ends the replay; it must not write memory.mc or registerFile.mc
+    hart.memory_file.clear();
+    hart.register_file.clear();
+
+    vector<BinaryTraceRecord> records(BINARY_TRACE_BATCH);
+    size_t count;
+    uint64_t index = 0;
+    while ((count = fread(records.data(), sizeof(BinaryTraceRecord), records.size(), in)) > 0) {
+        for (size_t k = 0; k < count; k++, index++) {
+            const BinaryTraceRecord &r = records[k];
+
+            hart.PC = r.pc;
+            memory.write_mem_word(r.pc, r.instruction);
+            hart.fetch();
+            hart.decode();
+            if (hart.terminate1) {
+                cerr << "ERROR: record " << index << " does not hold a valid instruction" << endl;
+                return 1;
+            }
+            hart.execute();
+
+            // give the load the value the recorded run read
+            if (r.mem & BINARY_TRACE_LOAD) {
+                int width_bytes = r.mem & 0xf;
+                if (width_bytes == 1) {
+                    memory.write_mem_byte(hart.memory_address, r.mem_value & 0xff);
+                } else if (width_bytes == 2) {
+                    memory.write_mem_half(hart.memory_address, r.mem_value & 0xffff);
+                } else {
+                    memory.write_mem_word(hart.memory_address, r.mem_value);
+                }
+            }
+            hart.mem();
+            hart.write_back();
+
+            if (r.rd != 0 && hart.X[r.rd] != r.rd_value) {
+                hart.trace_out.flush();
+                cerr << "WARNING: record " << index << " wrote " << nhex(r.rd_value)
+                     << " to X" << int(r.rd) << ", the replay computed " << nhex(hart.X[r.rd]) << endl;
+                hart.X[r.rd] = r.rd_value;
+            }
+
+            hart.end_clock_cycle(r.pc);
+        }
+    }
+    fclose(in);
+
+    if (hart.trace_level >= TRACE_SUMMARY) {
+        hart.trace_out << "Total clock cycles: " << hart.clock_cycles << '\n';
+    }
+    hart.trace_out.flush();
+    return 0;
+}
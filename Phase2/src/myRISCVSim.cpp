@@ -1,203 +1,568 @@
 #include <bits/stdc++.h>
 #include "../include/myARMSim.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_X86_64 1
+#endif
 using namespace std;
 
-// Structure: {opcode, {funcKey, {operation, alu_control_signal, instruction_type}}}
-const unordered_map<int, unordered_map<string, tuple<string, int, string>>> instruction_map = {
+// Instruction formats
+// FORMAT_A is the R-type layout of the A extension, whose aq/rl bits (26:25) are ignored.
+enum InstructionFormat { FORMAT_R, FORMAT_I, FORMAT_S, FORMAT_SB, FORMAT_U, FORMAT_UJ, FORMAT_A };
+
+// One supported instruction. func3/func7 of -1 match any value.
+struct InstructionSpec
+{
+    const char *operation;
+    int opcode;
+    int func3;
+    int func7;
+    int alu_control_signal;
+    InstructionFormat format;
+};
+
+// The supported subset of RV32. the decode table below is generated from this list.
+constexpr InstructionSpec instruction_set[] = {
     // R-type instructions (opcode 0110011)
-    {0b0110011, {
-        {"0_0", {"add", 2, "R"}},
-        {"0_32", {"sub", 8, "R"}},       
-        {"7_0", {"and", 1, "R"}},
-        {"6_0", {"or", 3, "R"}},
-        {"1_0", {"sll", 4, "R"}},
-        {"2_0", {"slt", 5, "R"}},
-        {"5_32", {"sra", 6, "R"}},
-        {"5_0", {"srl", 7, "R"}},
-        {"4_0", {"xor", 9, "R"}},
-        {"0_1", {"mul", 10, "R"}},
-        {"4_1", {"div", 11, "R"}},
-        {"6_1", {"rem", 12, "R"}}
-    }},
-    
+    {"add", 0b0110011, 0, 0, 2, FORMAT_R},
+    {"sub", 0b0110011, 0, 32, 8, FORMAT_R},
+    {"and", 0b0110011, 7, 0, 1, FORMAT_R},
+    {"or", 0b0110011, 6, 0, 3, FORMAT_R},
+    {"sll", 0b0110011, 1, 0, 4, FORMAT_R},
+    {"slt", 0b0110011, 2, 0, 5, FORMAT_R},
+    {"sra", 0b0110011, 5, 32, 6, FORMAT_R},
+    {"srl", 0b0110011, 5, 0, 7, FORMAT_R},
+    {"xor", 0b0110011, 4, 0, 9, FORMAT_R},
+    {"mul", 0b0110011, 0, 1, 10, FORMAT_R},
+    {"div", 0b0110011, 4, 1, 11, FORMAT_R},
+    {"rem", 0b0110011, 6, 1, 12, FORMAT_R},
+
     // I-type ALU instructions (opcode 0010011)
-    {0b0010011, {
-        {"0_-1", {"addi", 14, "I"}},
-        {"7_-1", {"andi", 13, "I"}},
-        {"6_-1", {"ori", 15, "I"}}
-    }},
-    
+    {"addi", 0b0010011, 0, -1, 14, FORMAT_I},
+    {"andi", 0b0010011, 7, -1, 13, FORMAT_I},
+    {"ori", 0b0010011, 6, -1, 15, FORMAT_I},
+
     // I-type Load instructions (opcode 0000011)
-    {0b0000011, {
-        {"0_-1", {"lb", 16, "I"}},
-        {"1_-1", {"lh", 17, "I"}},
-        {"2_-1", {"lw", 18, "I"}},
-        {"3_-1", {"ld", 30, "I"}}
-    }},
-    
+    {"lb", 0b0000011, 0, -1, 16, FORMAT_I},
+    {"lh", 0b0000011, 1, -1, 17, FORMAT_I},
+    {"lw", 0b0000011, 2, -1, 18, FORMAT_I},
+    {"ld", 0b0000011, 3, -1, 30, FORMAT_I},
+
     // JALR instruction (opcode 1100111)
-    {0b1100111, {
-        {"0_-1", {"jalr", 19, "I"}}
-    }},
-    
+    {"jalr", 0b1100111, 0, -1, 19, FORMAT_I},
+
     // S-type instructions (opcode 0100011)
-    {0b0100011, {
-        {"0_-1", {"sb", 20, "S"}},
-        {"1_-1", {"sh", 22, "S"}},
-        {"2_-1", {"sw", 21, "S"}},
-        {"3_-1", {"sd", 31, "S"}}
-    }},
-    
+    {"sb", 0b0100011, 0, -1, 20, FORMAT_S},
+    {"sh", 0b0100011, 1, -1, 22, FORMAT_S},
+    {"sw", 0b0100011, 2, -1, 21, FORMAT_S},
+    {"sd", 0b0100011, 3, -1, 31, FORMAT_S},
+
     // SB-type branch instructions (opcode 1100011)
-    {0b1100011, {
-        {"0_-1", {"beq", 23, "SB"}},
-        {"1_-1", {"bne", 24, "SB"}},
-        {"5_-1", {"bge", 25, "SB"}},
-        {"4_-1", {"blt", 26, "SB"}}
-    }},
-    
+    {"beq", 0b1100011, 0, -1, 23, FORMAT_SB},
+    {"bne", 0b1100011, 1, -1, 24, FORMAT_SB},
+    {"bge", 0b1100011, 5, -1, 25, FORMAT_SB},
+    {"blt", 0b1100011, 4, -1, 26, FORMAT_SB},
+
     // U-type instructions
-    {0b0010111, {
-        {"-1_-1", {"auipc", 27, "U"}}
-    }},
-    {0b0110111, {
-        {"-1_-1", {"lui", 28, "U"}}
-    }},
-    
+    {"auipc", 0b0010111, -1, -1, 27, FORMAT_U},
+    {"lui", 0b0110111, -1, -1, 28, FORMAT_U},
+
     // UJ-type instructions
-    {0b1101111, {
-        {"-1_-1", {"jal", 29, "UJ"}}
-    }}
+    {"jal", 0b1101111, -1, -1, 29, FORMAT_UJ},
+
+    // A extension, word operations (opcode 0101111, func7 is funct5 << 2)
+    {"lr.w", 0b0101111, 2, 0b0001000, 32, FORMAT_A},
+    {"sc.w", 0b0101111, 2, 0b0001100, 33, FORMAT_A},
+    {"amoswap.w", 0b0101111, 2, 0b0000100, 34, FORMAT_A},
+    {"amoadd.w", 0b0101111, 2, 0b0000000, 35, FORMAT_A},
+    {"amoxor.w", 0b0101111, 2, 0b0010000, 36, FORMAT_A},
+    {"amoand.w", 0b0101111, 2, 0b0110000, 37, FORMAT_A},
+    {"amoor.w", 0b0101111, 2, 0b0100000, 38, FORMAT_A},
+    {"amomin.w", 0b0101111, 2, 0b1000000, 39, FORMAT_A},
+    {"amomax.w", 0b0101111, 2, 0b1010000, 40, FORMAT_A},
+    {"amominu.w", 0b0101111, 2, 0b1100000, 41, FORMAT_A},
+    {"amomaxu.w", 0b0101111, 2, 0b1110000, 42, FORMAT_A},
+};
+
+const int INSTRUCTION_COUNT = sizeof(instruction_set) / sizeof(instruction_set[0]);
+const uint8_t DECODE_BY_FUNC7 = 0x80;
+
+// Decode table. slot[opcode << 3 | func3] holds 1 + the instruction_set index,
+// 0 for an illegal encoding, or DECODE_BY_FUNC7 | row when func7 picks the
+// instruction through func7_row[row][func7].
+struct DecodeTable
+{
+    uint8_t slot[128 * 8];
+    uint8_t func7_row[16][128];
 };
 
-// Register file - 32 registers (x0 to x31)
-string X[32];
+// Stores entry in a slot, or in the unused func7 cells of its row. exact matches are placed first.
+constexpr void fill_decode_slot(DecodeTable &table, int slot, uint8_t entry)
+{
+    if (table.slot[slot] == 0)
+    {
+        table.slot[slot] = entry;
+    }
+    else if (table.slot[slot] & DECODE_BY_FUNC7)
+    {
+        for (int func7 = 0; func7 < 128; func7++)
+        {
+            uint8_t &cell = table.func7_row[table.slot[slot] & ~DECODE_BY_FUNC7][func7];
+            if (cell == 0)
+            {
+                cell = entry;
+            }
+        }
+    }
+}
 
-int clock_cycles = 0; //cycle counter
+constexpr DecodeTable build_decode_table()
+{
+    DecodeTable table{};
+    int rows = 0;
 
-unsigned int PC = 0; //program counter
+    // exact func3 and func7
+    for (int i = 0; i < INSTRUCTION_COUNT; i++)
+    {
+        const InstructionSpec &spec = instruction_set[i];
+        if (spec.func7 >= 0)
+        {
+            int slot = (spec.opcode << 3) | spec.func3;
+            if (table.slot[slot] == 0)
+            {
+                table.slot[slot] = DECODE_BY_FUNC7 | rows++;
+            }
+            // an A-extension entry also covers its aq/rl variants
+            for (int aqrl = 0; aqrl < (spec.format == FORMAT_A ? 4 : 1); aqrl++)
+            {
+                table.func7_row[table.slot[slot] & ~DECODE_BY_FUNC7][spec.func7 | aqrl] = i + 1;
+            }
+        }
+    }
 
-unordered_map<unsigned int, string> MEM; // memory stored in the form of unordered map.
+    // wildcard func7, then wildcard func3 and func7
+    for (int i = 0; i < INSTRUCTION_COUNT; i++)
+    {
+        const InstructionSpec &spec = instruction_set[i];
+        if (spec.func7 < 0 && spec.func3 >= 0)
+        {
+            fill_decode_slot(table, (spec.opcode << 3) | spec.func3, i + 1);
+        }
+    }
+    for (int i = 0; i < INSTRUCTION_COUNT; i++)
+    {
+        const InstructionSpec &spec = instruction_set[i];
+        if (spec.func3 < 0)
+        {
+            for (int func3 = 0; func3 < 8; func3++)
+            {
+                fill_decode_slot(table, (spec.opcode << 3) | func3, i + 1);
+            }
+        }
+    }
+    return table;
+}
 
-// data path and control path signal. 
-unsigned int memory_address = 0;
-int alu_control_signal = -1;
-vector<int> is_mem{-1, -1}; // this stores the type of memory instruction. 
-bool write_back_signal = false; //write back signal for the mux.
-bool terminate1 = false;
-int inc_select = 0; //mux select line
-int pc_select = 0;  // mux select line
-int return_address = -1;
-int pc_offset = 0;
+constexpr DecodeTable decode_table = build_decode_table();
 
-string instruction_word = "0x00000000";
-string operand1 = "0x00000000";
-string operand2 = "0x00000000";
-string operation = "";
-string rd = "0";
-string offset = "0";
-string register_data = "0x00000000";
+// TRACE(stage) << ... prints a stage line; TRACE_AT(level) << ... prints from that level up.
+// when the line is off, none of its operands are evaluated or formatted.
+#define TRACE(stage) if (!trace_on(stage)) {} else trace_out
+#define TRACE_AT(level) if (trace_level < (level)) {} else trace_out
 
-// utility: to convert int to hex format
-string nhex(int num)
+// Parses a --trace or --trace-stages option at argv[i]. returns false if argv[i] is not one.
+bool Hart::parse_trace_option(int argc, char *argv[], int &i)
 {
-    // this is to handle negative numbers
-    if (num < 0)
+    string arg = argv[i];
+    if (arg == "--trace" && i + 1 < argc)
+    {
+        // off, summary, instruction or stage (default)
+        string level = argv[++i];
+        trace_level = (level == "off") ? TRACE_OFF : (level == "summary") ? TRACE_SUMMARY :
+                      (level == "instruction") ? TRACE_INSTRUCTION : TRACE_STAGE;
+        return true;
+    }
+    if (arg == "--trace-stages" && i + 1 < argc)
     {
-        num += (1LL << 32);
+        // comma separated list of fetch, decode, execute, memory, writeback
+        stringstream list(argv[++i]);
+        string stage;
+        trace_stages = 0;
+        while (getline(list, stage, ','))
+        {
+            trace_stages |= (stage == "fetch") ? TRACE_FETCH : (stage == "decode") ? TRACE_DECODE :
+                            (stage == "execute") ? TRACE_EXECUTE : (stage == "memory") ? TRACE_MEMORY :
+                            (stage == "writeback") ? TRACE_WRITEBACK : 0;
+        }
+        return true;
     }
+    return false;
+}
 
-    stringstream ss;
-    ss << "0x" << setfill('0') << setw(8) << hex << num << dec;
-    return ss.str();
+void Hart::close_binary_trace()
+{
+    if (!binary_trace_file)
+    {
+        return;
+    }
+    fwrite(binary_trace_buffer.data(), sizeof(BinaryTraceRecord), binary_trace_buffer.size(), binary_trace_file);
+    fclose(binary_trace_file);
+    binary_trace_file = nullptr;
+    binary_trace_buffer.clear();
 }
 
-// utility: to convert to int with sign extension.
-int nint(const string &s, int base, int bits = 32)
+// starts a binary trace of the run from the current processor state
+void Hart::open_binary_trace(const string &file_name)
 {
-    // convert string to long long unsigned.
-    unsigned long long num = stoull(s, nullptr, base);
+    binary_trace_file = fopen(file_name.c_str(), "wb");
+    if (!binary_trace_file)
+    {
+        trace_out.flush();
+        cerr << "ERROR: cannot open trace file" << endl;
+        exit(1);
+    }
+
+    BinaryTraceHeader header = {};
+    memcpy(header.magic, BINARY_TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(BinaryTraceRecord);
+    header.clock_cycles = clock_cycles;
+    memcpy(header.X, X, sizeof(header.X));
+    header.X_written = X_written;
+    fwrite(&header, sizeof(header), 1, binary_trace_file);
+
+    binary_trace_buffer.reserve(BINARY_TRACE_BATCH);
+}
 
-    // this is to sign extend
-    if (num >= (1ULL << (bits - 1)))
+// appends the record of the instruction at pc, called once write_back() is done
+void Hart::record_binary_trace(uint32_t pc)
+{
+    BinaryTraceRecord r = {};
+    r.pc = pc;
+    r.instruction = instruction_word;
+    if (write_back_signal && rd != 0)
+    {
+        r.rd = static_cast<uint8_t>(rd);
+        r.rd_value = register_data;
+    }
+    if (is_mem[0] != -1)
+    {
+        int width_bytes = (is_mem[1] == 0) ? 1 : (is_mem[1] == 1) ? 2 : (is_mem[1] == 3) ? 4 : 8;
+        r.mem = width_bytes | (is_mem[0] == 0 ? BINARY_TRACE_LOAD : BINARY_TRACE_STORE);
+        if (is_mem[0] == 2)
+        {
+            // LR and the AMOs record the word they read; sc.w records its result
+            r.mem = width_bytes | (alu_control_signal == 33 ? BINARY_TRACE_STORE : BINARY_TRACE_LOAD | BINARY_TRACE_STORE);
+        }
+        r.mem_address = memory_address;
+        r.mem_value = register_data;
+    }
+    if (pc_select || inc_select)
     {
-        num -= (1ULL << bits);
+        r.flags |= BINARY_TRACE_TAKEN;
     }
 
-    return static_cast<int>(num);
+    binary_trace_buffer.push_back(r);
+    if (binary_trace_buffer.size() == BINARY_TRACE_BATCH)
+    {
+        fwrite(binary_trace_buffer.data(), sizeof(BinaryTraceRecord), binary_trace_buffer.size(), binary_trace_file);
+        binary_trace_buffer.clear();
+    }
 }
 
-string sign_extend(std::string data, int bit_length)
+void Hart::pipeline_issue(uint32_t pc)
 {
-    if (data.substr(0, 2) == "0x") // check if the input is in hexadecimal format
-    {                                                             // handling hexadecimal input
-        char highDigit = data[2];                                 // first digit after "0x"
-        bool isNegative = (highDigit >= '8' && highDigit <= 'f'); // checking if the number is negative based on the most significant digit
+    const DecodedInstruction *d = memory.lookup_decoded(pc, instruction_word);
+    PipelineSlot slot;
+    slot.valid = true;
+    slot.pc = pc;
+    slot.next_pc = PC;
+    slot.rd = write_back_signal ? d->rd : 0;
+    slot.rs1 = (d->format == FORMAT_U || d->format == FORMAT_UJ) ? 0 : d->rs1;
+    slot.rs2 = (d->format == FORMAT_R || d->format == FORMAT_S || d->format == FORMAT_SB || d->format == FORMAT_A) ? d->rs2 : 0;
+    slot.load = (is_mem[0] == 0 || is_mem[0] == 2);
+    slot.control = (d->format == FORMAT_SB) ? CONTROL_BRANCH : (d->format == FORMAT_UJ) ? CONTROL_JAL :
+                   (alu_control_signal == 19) ? CONTROL_JALR : CONTROL_NONE;
+    slot.target = (slot.control == CONTROL_BRANCH || slot.control == CONTROL_JAL) ? pc + d->imm : 0;
+    slot.fetch_stall = fetch_stall;
+    slot.memory_stall = memory_stall;
+    pipeline->issue(slot);
+}
 
-        if (isNegative)
+Memory::~Memory()
+{
+    for (Page **table : page_table)
+    {
+        for (int p = 0; table && p < 1024; p++)
         {
-            // if the number is negative, extend with 'f' to preserve sign
-            data = "0x" + std::string(8 - (data.length() - 2), 'f') + data.substr(2); 
+            Page *page = table[p];
+            if (!page)
+            {
+                continue;
+            }
+            delete[] page->decoded;
+            char *where = reinterpret_cast<char *>(page);
+            if (!(where >= checkpoint_image && where < checkpoint_image + checkpoint_size))
+            {
+                delete page;
+            }
         }
-        else
+        delete[] table;
+    }
+#ifdef HAVE_MMAP
+    if (checkpoint_image)
+    {
+        munmap(checkpoint_image, checkpoint_size);
+    }
+#else
+    operator delete(checkpoint_image);
+#endif
+}
+
+// utility: to convert a 32-bit value to "0x" followed by 8 lowercase hex digits
+string nhex(uint32_t num)
+{
+    char buf[11];
+    snprintf(buf, sizeof(buf), "0x%08x", num);
+    return string(buf);
+}
+
+// utility: "0x" followed by 8 uppercase hex digits, as the fetch trace prints words
+static string nhex_upper(uint32_t num)
+{
+    char buf[11];
+    snprintf(buf, sizeof(buf), "0x%08X", num);
+    return string(buf);
+}
+
+// utility: to sign extend the low `bits` bits of a value.
+int32_t sign_extend(uint32_t value, int bits)
+{
+    uint32_t m = 1u << (bits - 1);
+    value &= (bits == 32) ? 0xffffffffu : ((1u << bits) - 1);
+    return static_cast<int32_t>((value ^ m) - m);
+}
+
+// Returns the page holding address, allocating a zero-filled page if needed
+Page *Memory::get_page(uint32_t address)
+{
+    Page *page = find_page(address);
+    if (page)
+    {
+        return page;
+    }
+
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (shared)
+    {
+        guard.lock();
+    }
+    Page **&table = page_table[address >> 22];
+    if (!table)
+    {
+        __atomic_store_n(&table, new Page *[1024](), __ATOMIC_RELEASE);
+    }
+    Page *&slot = table[(address >> PAGE_SHIFT) & 0x3ff];
+    if (!slot)
+    {
+        __atomic_store_n(&slot, new Page(), __ATOMIC_RELEASE);
+    }
+    return slot;
+}
+
+// Marks `count` bytes from `address` as present so that memory.mc reports them.
+// loads only mark pages that already exist; stores also drop the upper-case flag.
+void Memory::mark_present(uint32_t address, int count, bool store)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t a = address + i;
+        Page *page = store ? get_page(a) : find_page(a);
+        if (page)
         {
-            // if the number is positive, extend with '0' to preserve sign
-            data = "0x" + std::string(8 - (data.length() - 2), '0') + data.substr(2); 
+            uint32_t off = a & PAGE_MASK;
+            uint64_t bit = 1ULL << (off & 63);
+            if (shared)
+            {
+                __atomic_fetch_or(&page->present[off >> 6], bit, __ATOMIC_RELAXED);
+            }
+            else
+            {
+                page->present[off >> 6] |= bit;
+            }
+            if (store)
+            {
+                if (track_dirty)
+                {
+                    if (!page->dirty_listed)
+                    {
+                        page->dirty_listed = true;
+                        dirty_pages.push_back(a >> PAGE_SHIFT);
+                    }
+                    page->dirty[off >> 8] |= 1ULL << ((off >> 2) & 63);
+                }
+                if (page->upper[off >> 6] & bit)
+                {
+                    __atomic_fetch_and(&page->upper[off >> 6], ~bit, __ATOMIC_RELAXED);
+                }
+                DecodedInstruction *decoded = __atomic_load_n(&page->decoded, __ATOMIC_ACQUIRE);
+                if (decoded && decoded[off >> 2].alu_control_signal >= 0)
+                {
+                    // stale once its bytes change
+                    __atomic_store_n(&decoded[off >> 2].alu_control_signal, -1, __ATOMIC_RELAXED);
+                    for (Hart *hart : harts)
+                    {
+                        hart->invalidate_blocks(a);
+                    }
+                }
+            }
         }
     }
-    else
-    { // handling binary input
-        if (data.length() < bit_length)
+}
+
+vector<pair<uint32_t, uint32_t>> Memory::take_dirty_ranges()
+{
+    vector<pair<uint32_t, uint32_t>> ranges;
+    sort(dirty_pages.begin(), dirty_pages.end());
+    for (uint32_t number : dirty_pages)
+    {
+        Page *page = find_page(number << PAGE_SHIFT);
+        for (uint32_t i = 0; i < PAGE_SIZE / 256; i++)
         {
-            char sign_bit = data[0]; // get the sign bit ('1' for negative, '0' for positive)
-            // extend the sign bit to match the required bit length
-            data = std::string(bit_length - data.length(), sign_bit) + data;
+            for (uint64_t bits = page->dirty[i]; bits; bits &= bits - 1)
+            {
+                uint32_t address = (number << PAGE_SHIFT) + 4 * (64 * i + __builtin_ctzll(bits));
+                if (!ranges.empty() && ranges.back().first + ranges.back().second == address)
+                {
+                    ranges.back().second += 4;
+                }
+                else
+                {
+                    ranges.push_back({address, 4});
+                }
+            }
+            page->dirty[i] = 0;
         }
+        page->dirty_listed = false;
+    }
+    dirty_pages.clear();
+    return ranges;
+}
+
+uint8_t Memory::read_mem_byte(uint32_t address)
+{
+    Page *page = find_page(address);
+    return page ? page->data[address & PAGE_MASK] : 0;
+}
+
+uint16_t Memory::read_mem_half(uint32_t address)
+{
+    if ((address & PAGE_MASK) > PAGE_SIZE - 2) // straddles two pages
+    {
+        return read_mem_byte(address) | (read_mem_byte(address + 1) << 8);
+    }
+    Page *page = find_page(address);
+    uint16_t value = 0;
+    if (page)
+    {
+        memcpy(&value, page->data + (address & PAGE_MASK), 2);
     }
-    return data; // return the sign-extended value
+    return value;
 }
 
-// Utility function: Convert binary string to hex string
-string bin_to_hex(const string &binary)
+uint32_t Memory::read_mem_word(uint32_t address)
 {
-    stringstream ss;
-    ss << "0x" << hex << stoull(binary, nullptr, 2) << dec;
-    return ss.str();
+    if ((address & PAGE_MASK) > PAGE_SIZE - 4) // straddles two pages
+    {
+        return read_mem_half(address) | (static_cast<uint32_t>(read_mem_half(address + 2)) << 16);
+    }
+    Page *page = find_page(address);
+    uint32_t value = 0;
+    if (page)
+    {
+        memcpy(&value, page->data + (address & PAGE_MASK), 4);
+    }
+    return value;
+}
+
+void Memory::write_mem_byte(uint32_t address, uint8_t value)
+{
+    get_page(address)->data[address & PAGE_MASK] = value;
+    mark_present(address, 1, true);
+}
+
+void Memory::write_mem_half(uint32_t address, uint16_t value)
+{
+    if ((address & PAGE_MASK) > PAGE_SIZE - 2)
+    {
+        write_mem_byte(address, value & 0xff);
+        write_mem_byte(address + 1, value >> 8);
+        return;
+    }
+    memcpy(get_page(address)->data + (address & PAGE_MASK), &value, 2);
+    mark_present(address, 2, true);
 }
 
-string hex_to_bin(const string &hex)
+void Memory::write_mem_word(uint32_t address, uint32_t value)
 {
-    string bin = ""; // initialize an empty string to store the binary representation
-    for (char c : hex)
+    if ((address & PAGE_MASK) > PAGE_SIZE - 4)
     {
-        // convert the hexadecimal character to its integer value
-        int value = (c >= '0' && c <= '9') ? (c - '0') : (10 + (c - 'a'));
-        
-        // convert the integer value to a 4-bit binary string and append to the result
-        bin += std::bitset<4>(value).to_string(); 
+        write_mem_half(address, value & 0xffff);
+        write_mem_half(address + 2, value >> 16);
+        return;
     }
-    return bin; // return the binary representation of the hexadecimal input
+    memcpy(get_page(address)->data + (address & PAGE_MASK), &value, 4);
+    mark_present(address, 4, true);
 }
 
 // Reset processor state - initialize registers
-void reset_proc()
+void Hart::reset_proc()
 {
     // initialize all registers to zero
     for (int i = 0; i < 32; i++)
     {
-        X[i] = "0x00000000";
+        X[i] = 0;
     }
+    X_written = 0;
 
     // set x2 and x3 to initial values.
-    X[2] = "0x7FFFFFDC";
-    X[3] = "0x10000000";
+    X[2] = 0x7FFFFFDC;
+    X[3] = 0x10000000;
+
+    reservation_address = NO_RESERVATION;
+}
+
+bool Hart::at_stop_point()
+{
+    return clock_cycles >= stop_cycle || PC == stop_pc;
+}
+
+// counts the cycle of the instruction at pc and prints its closing trace line
+void Hart::end_clock_cycle(uint32_t pc)
+{
+    clock_cycles++;
+
+    if (trace_level == TRACE_INSTRUCTION)
+    {
+        char line[64];
+        snprintf(line, sizeof(line), "Clock Cycle: %lld | 0x%08x: 0x%08x ", clock_cycles, pc, instruction_word);
+        trace_out << line << operation << '\n';
+    }
+    TRACE_AT(TRACE_STAGE) << "Clock Cycle: " << clock_cycles << '\n'
+         << '\n';
 }
 
 // main simulation function that executes the RISC-V program
-void run_RISCVsim()
+void Hart::run_RISCVsim()
 {
     while (true)
     {
+        uint32_t pc = PC;
         fetch();
         decode();
 
@@ -216,814 +581,2241 @@ void run_RISCVsim()
         mem();
         write_back();
 
-        clock_cycles++;
+        if (binary_trace_file)
+        {
+            record_binary_trace(pc);
+        }
+        if (pipeline)
+        {
+            pipeline_issue(pc);
+        }
 
-        cout << "Clock Cycle: " << clock_cycles << endl
-             << endl;
+        end_clock_cycle(pc);
+
+        if (at_stop_point())
+        {
+            return;
+        }
     }
 }
 
 // load program from memory file
-void load_program_memory(const string &file_name)
+void Hart::load_program_memory(const string &file_name)
 {
-    ifstream infile(file_name);
-
-    // check if the file is open, otherwise print an error and exit
-    if (!infile)
+    vector<string> errors;
+    if (!load_program(file_name, errors))
     {
-        cerr << "ERROR: cannot open input file" << endl;
+        // print every malformed line, then exit
+        trace_out.flush();
+        for (const string &error : errors)
+        {
+            cerr << "ERROR: " << file_name << ": " << error << endl;
+        }
         exit(1);
     }
+}
 
-    string address, instr;
+// Memory dumps. pages are visited in address order through the page table,
+// so a dump costs the allocated pages in the range, not the size of the range.
+// text output is formatted by hand into the FILE buffer.
+const size_t DUMP_BUFFER_SIZE = 1 << 20;
 
-    // read each line and extract address and instruction
-    while (infile >> address >> instr)
+bool Memory::dump(const string &file_name, uint32_t start, uint64_t end, DumpFormat format)
+{
+    FILE *out = fopen(file_name.c_str(), format == DUMP_BINARY ? "wb" : "w");
+    if (!out)
+    {
+        return false;
+    }
+    vector<char> buffer(DUMP_BUFFER_SIZE);
+    setvbuf(out, buffer.data(), _IOFBF, buffer.size());
+
+    static const char lower[] = "0123456789abcdef";
+    static const char upper_digits[] = "0123456789ABCDEF";
+    end = min<uint64_t>(end, 1ULL << 32); // the page table covers 32-bit addresses only
+    uint64_t first = start & ~PAGE_MASK;
+    for (uint64_t base = first; base < end; base += PAGE_SIZE)
     {
-        write_word(address, instr); // store the instruction in memory
+        Page **table = page_table[base >> 22];
+        if (!table)
+        {
+            base |= (1u << 22) - PAGE_SIZE; // skip the rest of this table
+            continue;
+        }
+        Page *page = table[(base >> PAGE_SHIFT) & 0x3ff];
+        if (!page)
+        {
+            continue;
+        }
+
+        uint32_t lo = (base < start) ? start - base : 0;
+        uint32_t hi = (end - base < PAGE_SIZE) ? static_cast<uint32_t>(end - base) : PAGE_SIZE;
+        if (format == DUMP_BINARY)
+        {
+            fseek(out, static_cast<long>(base + lo - start), SEEK_SET);
+            fwrite(page->data + lo, 1, hi - lo, out);
+            continue;
+        }
+
+        // words with a present byte, 16 words per 64-bit group of the present bitmap
+        for (uint32_t group = (lo & ~3u) >> 6; group < (hi + 63) >> 6; group++)
+        {
+            uint64_t bits = page->present[group];
+            for (uint32_t w = 0; bits && w < 16; w++, bits >>= 4)
+            {
+                uint32_t off = (group << 6) + 4 * w;
+                if (!(bits & 0xf) || off < (lo & ~3u) || off >= hi)
+                {
+                    continue;
+                }
+                // "0x" + address without leading zeros + " 0x" + the bytes, keeping their case
+                char line[32];
+                char *p = line + 2;
+                uint32_t address = static_cast<uint32_t>(base) + off;
+                line[0] = '0';
+                line[1] = 'x';
+                int digits = 1;
+                while (digits < 8 && (address >> (4 * digits)))
+                {
+                    digits++;
+                }
+                for (int d = digits - 1; d >= 0; d--)
+                {
+                    *p++ = lower[(address >> (4 * d)) & 0xf];
+                }
+                *p++ = ' ';
+                *p++ = '0';
+                *p++ = 'x';
+                for (int b = 3; b >= 0; b--)
+                {
+                    uint8_t byte = page->data[off + b];
+                    const char *hex = ((page->upper[(off + b) >> 6] >> ((off + b) & 63)) & 1) ? upper_digits : lower;
+                    *p++ = hex[byte >> 4];
+                    *p++ = hex[byte & 0xf];
+                }
+                *p++ = '\n';
+                fwrite(line, 1, p - line, out);
+            }
+        }
     }
 
-    infile.close(); // close the file after reading it.
+    // a raw image always covers the whole range, even when it ends in a hole
+    if (format == DUMP_BINARY && end > start)
+    {
+        fseek(out, 0, SEEK_END);
+        if (static_cast<uint64_t>(ftell(out)) < end - start)
+        {
+            fseek(out, static_cast<long>(end - start - 1), SEEK_SET);
+            fputc(0, out);
+        }
+    }
+    fclose(out);
+    return true;
 }
 
-// Write memory contents to output files
-void write_data_memory()
+// Write memory contents to output files. an empty memory_file or
+// register_file skips that file, as the harts of a multi-hart run share one memory.mc.
+void Hart::write_data_memory()
 {
     // write data memory to data_out.mc
-    ofstream data_out("memory.mc");
-    if (!data_out.is_open())
+    if (!memory_file.empty() && !memory.dump(memory_file, dump_start, dump_end, dump_format))
     {
         cout << "ERROR: Error opening memory file" << endl;
         return;
     }
 
-    // data memory range from 268435456 to 268468221 (0x10000000 to 0x1000FFFD)
-    for (unsigned int i = 268435456; i < 268468221; i += 4)
+    if (register_file.empty())
     {
-        if (MEM.find(i) != MEM.end() || MEM.find(i + 1) != MEM.end() ||
-            MEM.find(i + 2) != MEM.end() || MEM.find(i + 3) != MEM.end())
-        {
-            // get value for each byte (default to "00" if not present)
-            string byte0 = MEM.count(i) ? MEM[i] : "00";
-            string byte1 = MEM.count(i + 1) ? MEM[i + 1] : "00";
-            string byte2 = MEM.count(i + 2) ? MEM[i + 2] : "00";
-            string byte3 = MEM.count(i + 3) ? MEM[i + 3] : "00";
-
-            data_out << "0x" << hex << i << " 0x" << byte3 << byte2 << byte1 << byte0 << dec << endl;
-        }
+        return;
     }
 
-    data_out.close();
-
     // write register contents to reg_out.mc
-    ofstream reg_out("registerFile.mc");
+    ofstream reg_out(register_file);
     if (!reg_out.is_open()){
         cout << "ERROR: Error opening registerFile" << endl;
         return;
     }
 
-    // iterate through all 32 registers and write their values
+    // iterate through all 32 registers and write their values.
+    // registers still holding their reset value keep the upper-case spelling of reset_proc().
     for (int i = 0; i < 32; i++)
     {
-        string reg_value = X[i];
-        reg_value = reg_value.substr(0, 2) + string(10 - reg_value.length(), '0') + reg_value.substr(2);    
+        char reg_value[11];
+        snprintf(reg_value, sizeof(reg_value), ((X_written >> i) & 1) ? "0x%08x" : "0x%08X", X[i]);
         reg_out << "x" << dec << i << " " << reg_value << endl;
     }
 }
 
-// Fetch stage: Read instruction from memory
-void fetch()
+// Checkpoints. a checkpoint file holds PC, clock_cycles and the register file,
+// followed by every allocated page stored as a whole Page, so restoring maps
+// the file and uses the pages where they lie (written pages are copied on write).
+const char CHECKPOINT_MAGIC[8] = {'R', 'V', 'C', 'K', 'P', 'T', '0', '3'};
+
+struct CheckpointHeader
 {
-    // construct 32-bit instruction from 4 bytes in memory (little-endian)
-    string byte0 = MEM.count(PC) ? MEM[PC] : "00";
-    string byte1 = MEM.count(PC + 1) ? MEM[PC + 1] : "00";
-    string byte2 = MEM.count(PC + 2) ? MEM[PC + 2] : "00";
-    string byte3 = MEM.count(PC + 3) ? MEM[PC + 3] : "00";
+    char magic[8];
+    int64_t clock_cycles;
+    uint32_t pc;
+    uint32_t X[32];
+    uint32_t X_written;
+    uint32_t page_count;
+};
 
-    // combine bytes to form the instruction word
-    instruction_word = "0x" + byte3 + byte2 + byte1 + byte0;
+struct CheckpointPage
+{
+    uint64_t page_number; // address >> PAGE_SHIFT
+    Page page;            // saved with no decoded records or dirty words
+};
 
-    // check if instruction is a halt instruction (all zeros)
-    if (instruction_word == "0x00000000")
+static_assert(sizeof(CheckpointHeader) % alignof(CheckpointPage) == 0, "pages in a checkpoint must stay aligned");
+
+// saves the current state to file_name
+void Hart::write_checkpoint(const string &file_name)
+{
+    FILE *out = fopen(file_name.c_str(), "wb");
+    if (!out)
     {
-        swi_exit(); // terminate execution
-        return;
+        trace_out.flush();
+        cerr << "ERROR: cannot open checkpoint file" << endl;
+        exit(1);
     }
 
-    // print fetched instruction and its address
-    cout << "FETCH: Retrieved instruction " << instruction_word << " at memory location 0x" << nhex(PC) << endl;
-
-    // reset pc increment and selection signals
-    inc_select = 0;
-    pc_select = 0;
-}
-
-// Decode stage: Identify instruction type and extract operands
-void decode()
-{
-    // instruction to end the simulation
-    if (instruction_word == "0x00000000")
+    CheckpointHeader header = {};
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.pc = PC;
+    header.clock_cycles = clock_cycles;
+    memcpy(header.X, X, sizeof(header.X));
+    header.X_written = X_written;
+    for (int t = 0; t < 1024; t++)
     {
-        cout << "Finished Simulation" << endl
-             << endl;
-        swi_exit();
-        return;
+        for (int p = 0; memory.page_table[t] && p < 1024; p++)
+        {
+            header.page_count += memory.page_table[t][p] != nullptr;
+        }
     }
-    
-    string hex_part = instruction_word.substr(2); // Remove '0x' prefix
-    string bin_instruction;
-
-    for (char c : hex_part) {
-        bin_instruction += bitset<4>(stoul(string(1, c), nullptr, 16)).to_string();
-    }
-    while (bin_instruction.length() < 32)
-    {
-        bin_instruction = "0" + bin_instruction;
-    }
-
-    int opcode = stoi(bin_instruction.substr(25, 7), nullptr, 2);
-    int func3 = -1;
-    int func7 = -1;
-    
-    if (bin_instruction.length() >= 20) {
-        func3 = stoi(bin_instruction.substr(17, 3), nullptr, 2);
-    }
-    
-    if (bin_instruction.length() >= 7) {
-        func7 = stoi(bin_instruction.substr(0, 7), nullptr, 2);
-    }
-
-    string op_type;
-    alu_control_signal = -1;
-    is_mem = {-1, -1};
-    
-    // Create key for function lookup
-    stringstream keyBuilder;
-    keyBuilder << func3 << "_" << func7;
-    string funcKey = keyBuilder.str();
-    string wildcardKey1 = to_string(func3) + "_-1";  // Wildcard for func7
-    string wildcardKey2 = "-1_-1";                  // Wildcard for both
-
-    // Lookup instruction in the dictionary
-    auto opcode_it = instruction_map.find(opcode);
-    if (opcode_it != instruction_map.end()) {
-        bool found = false;
-        
-        // First try exact match
-        auto func_it = opcode_it->second.find(funcKey);
-        
-        // If not found, try with wildcard func7
-        if (func_it == opcode_it->second.end()) {
-            func_it = opcode_it->second.find(wildcardKey1);
-            
-            // If still not found, try with wildcard func3 and func7
-            if (func_it == opcode_it->second.end()) {
-                func_it = opcode_it->second.find(wildcardKey2);
+    fwrite(&header, sizeof(header), 1, out);
+
+    CheckpointPage record;
+    for (int t = 0; t < 1024; t++)
+    {
+        for (int p = 0; memory.page_table[t] && p < 1024; p++)
+        {
+            if (memory.page_table[t][p])
+            {
+                record.page_number = (t << 10) | p;
+                memcpy(&record.page, memory.page_table[t][p], sizeof(Page));
+                record.page.decoded = nullptr;
+                memset(record.page.dirty, 0, sizeof(record.page.dirty));
+                record.page.dirty_listed = false;
+                fwrite(&record, sizeof(record), 1, out);
             }
         }
-        
-        if (func_it != opcode_it->second.end()) {
-            operation = get<0>(func_it->second);
-            alu_control_signal = get<1>(func_it->second);
-            op_type = get<2>(func_it->second);
-            found = true;
-        }
-        
-        if (!found) {
-            cout << "ERROR: Invalid machine code" << endl;
-            swi_exit();
-            return;
-        }
-    } else {
-        cout << "ERROR: Invalid machine code" << endl;
-        swi_exit();
-        return;
     }
+    fclose(out);
+}
 
-    // Extract operands based on instruction type
-    if (op_type == "R")
+// loads the state saved by write_checkpoint() in place of load_program_memory()
+void Hart::restore_checkpoint(const string &file_name)
+{
+    char *image = nullptr;
+    size_t size = 0;
+#ifdef HAVE_MMAP
+    int fd = open(file_name.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0)
     {
-        // Extract register fields
-        string rs2 = bin_instruction.substr(7, 5);
-        string rs1 = bin_instruction.substr(12, 5);
-        rd = bin_instruction.substr(20, 5);
-
-        // Read values from registers
-        operand1 = X[stoi(rs1, nullptr, 2)];
-        operand2 = X[stoi(rs2, nullptr, 2)];
-        write_back_signal = true;
-
-        cout << "DECODE: Identified " << operation << " operation | Source: X" 
-        << stoi(rs1, nullptr, 2) << " (0x" << hex << operand1 << dec << "), X" 
-        << stoi(rs2, nullptr, 2) << " (0x" << hex << operand2 << dec << ") | Destination Register: X" 
-        << stoi(rd, nullptr, 2) << endl;
-
-        cout << "DECODE: Read source registers: X" << stoi(rs1, nullptr, 2) << " -> "
-             << nint(operand1, 16) << ", X" << stoi(rs2, nullptr, 2) << " -> "
-             << nint(operand2, 16) << endl;
+        size = st.st_size;
+        void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        image = (map == MAP_FAILED) ? nullptr : static_cast<char *>(map);
     }
-    else if (op_type == "I")
+    if (fd >= 0)
     {
-        // Extract register fields and immediate
-        string rs1 = bin_instruction.substr(12, 5);
-        rd = bin_instruction.substr(20, 5);
-        string imm = bin_instruction.substr(0, 12);
-
-        operand1 = X[stoi(rs1, nullptr, 2)];
-        operand2 = imm;
-        write_back_signal = true;
-
-        cout << "DECODE: Identified " << operation << "operation | Source: X"
-             << stoi(rs1, nullptr, 2) << "| immediate is " << nint(operand2, 2, operand2.length())
-             << "| Destination Register: X" << stoi(rd, nullptr, 2) << endl;
-
-        cout << "DECODE: Read source registers: X" << stoi(rs1, nullptr, 2) << " -> "
-             << nint(operand1, 16) << endl;
+        close(fd);
     }
-    else if (op_type == "S")
+#else
+    ifstream in(file_name, ios::binary);
+    if (in)
     {
-        // Extract register fields and immediate
-        string rs2 = bin_instruction.substr(7, 5);
-        string rs1 = bin_instruction.substr(12, 5);
-        string imm = bin_instruction.substr(0, 7) + bin_instruction.substr(20, 5);
-
-        operand1 = X[stoi(rs1, nullptr, 2)];
-        operand2 = imm;
-        register_data = X[stoi(rs2, nullptr, 2)];
-        write_back_signal = false;
-
-        cout << "DECODE: Identified " << operation << "operation | Source: X"
-             << stoi(rs1, nullptr, 2) << "| immediate is " << nint(operand2, 2, operand2.length())
-             << "| Destination Register: X" << stoi(rs2, nullptr, 2) << endl;
-
-        cout << "DECODE: Read source registers: X" << stoi(rs1, nullptr, 2) << " -> "
-             << nint(operand1, 16) << ", X" << stoi(rs2, nullptr, 2) << " -> "
-             << nint(register_data, 16) << endl;
+        in.seekg(0, ios::end);
+        size = in.tellg();
+        in.seekg(0);
+        image = static_cast<char *>(operator new(size));
+        in.read(image, size);
     }
-    else if (op_type == "SB")
+#endif
+    if (!image)
     {
-        // Extract register fields and immediate for branch instructions
-        string rs2 = bin_instruction.substr(7, 5);
-        string rs1 = bin_instruction.substr(12, 5);
-
-        operand1 = X[stoi(rs1, nullptr, 2)];
-        operand2 = X[stoi(rs2, nullptr, 2)];
-
-        // Branch immediate format is complex in RISC-V
-        string imm = bin_instruction.substr(0, 1) + bin_instruction.substr(24, 1) +
-                     bin_instruction.substr(1, 6) + bin_instruction.substr(20, 4) + "0";
-
-        offset = imm;
-        write_back_signal = false;
-
-        cout << "DECODE: Identified " << operation << " operation | Compare: X" 
-     << stoi(rs1, nullptr, 2) << " (0x" << hex << operand1 << dec << ") with X" 
-     << stoi(rs2, nullptr, 2) << " (0x" << hex << operand2 << dec << ") | Branch offset: " 
-     << nint(offset, 2, offset.length()) << endl;
-
-        cout << "DECODE: Read source registers: X" << stoi(rs1, nullptr, 2) << " -> "
-             << nint(operand1, 16) << ", X" << stoi(rs2, nullptr, 2) << " -> "
-             << nint(operand2, 16) << endl;
+        trace_out.flush();
+        cerr << "ERROR: cannot open checkpoint file" << endl;
+        exit(1);
     }
-    else if (op_type == "U")
-    {
-        // U-type instructions (LUI, AUIPC) with upper immediate
-        rd = bin_instruction.substr(20, 5);
-        string imm = bin_instruction.substr(0, 20);
-
-        write_back_signal = true;
-
-        cout << "DECODE: Identified " << operation << "operation | immediate is "
-             << nint(imm, 2, imm.length()) << "| Destination register X"
-             << stoi(rd, nullptr, 2) << endl;
 
-        // Add 12 zeros to the right (shift left by 12)
-        imm += string(12, '0');
-        operand2 = imm;
+    const CheckpointHeader *header = reinterpret_cast<const CheckpointHeader *>(image);
+    if (size < sizeof(CheckpointHeader) || memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 ||
+        size != sizeof(CheckpointHeader) + header->page_count * sizeof(CheckpointPage))
+    {
+        trace_out.flush();
+        cerr << "ERROR: " << file_name << " is not a checkpoint" << endl;
+        exit(1);
     }
-    else if (op_type == "UJ")
+    // every page number must fit the 32-bit address space and appear once,
+    // checked before the page table is touched
+    CheckpointPage *records = reinterpret_cast<CheckpointPage *>(image + sizeof(CheckpointHeader));
+    vector<bool> seen(1u << 20);
+    for (uint32_t i = 0; i < header->page_count; i++)
     {
-        // UJ-type instructions (JAL)
-        rd = bin_instruction.substr(20, 5);
+        uint64_t page_number = records[i].page_number;
+        if (page_number >= (1u << 20) || seen[page_number])
+        {
+            trace_out.flush();
+            cerr << "ERROR: " << file_name << ": bad or repeated page number " << page_number << endl;
+            exit(1);
+        }
+        seen[page_number] = true;
+    }
+    memory.checkpoint_image = image;
+    memory.checkpoint_size = size;
 
-        // JAL immediate format is complex in RISC-V
-        string imm = bin_instruction.substr(0, 1) + bin_instruction.substr(12, 8) +
-                     bin_instruction.substr(11, 1) + bin_instruction.substr(1, 10);
+    PC = header->pc;
+    clock_cycles = header->clock_cycles;
+    memcpy(X, header->X, sizeof(X));
+    X_written = header->X_written;
 
-        write_back_signal = true;
+    for (uint32_t i = 0; i < header->page_count; i++)
+    {
+        // a saved pointer or dirty state means nothing here; clearing them only
+        // when set keeps pages of a well-formed file shared with the mapping
+        Page &page = records[i].page;
+        bool dirty = page.decoded || page.dirty_listed;
+        for (uint64_t word : page.dirty)
+        {
+            dirty |= word != 0;
+        }
+        if (dirty)
+        {
+            page.decoded = nullptr;
+            page.dirty_listed = false;
+            memset(page.dirty, 0, sizeof(page.dirty));
+        }
+        Page **&table = memory.page_table[records[i].page_number >> 10];
+        if (!table)
+        {
+            table = new Page *[1024]();
+        }
+        table[records[i].page_number & 0x3ff] = &records[i].page;
+    }
+}
 
-        cout << "DECODE: Identified " << operation << "operation | immediate is "
-             << nint(imm, 2, imm.length()) << "| Destination register X"
-             << stoi(rd, nullptr, 2) << endl;
+// Fetch stage: Read instruction from memory
+void Hart::fetch()
+{
+    // construct 32-bit instruction from 4 bytes in memory (little-endian)
+    instruction_word = memory.read_mem_word(PC);
+    fetch_stall = caches ? caches->fetch(PC) : 0;
 
-        // Append a 0 to the right (shift left by 1)
-        imm += "0";
-        offset = imm;
+    // check if instruction is a halt instruction (all zeros); decode() ends the run
+    if (instruction_word == 0)
+    {
+        return;
     }
-    else
+
+    // print fetched instruction and its address
+    TRACE(TRACE_FETCH) << "FETCH: Retrieved instruction " << nhex_upper(instruction_word) << " at memory location 0x" << nhex(PC) << '\n';
+
+    // reset pc increment and selection signals
+    inc_select = 0;
+    pc_select = 0;
+}
+
+// Decodes an instruction word into d. returns false for invalid machine code.
+bool decode_instruction(uint32_t word, DecodedInstruction &d)
+{
+    uint8_t entry = decode_table.slot[((word & 0x7f) << 3) | ((word >> 12) & 0x7)];
+    if (entry & DECODE_BY_FUNC7)
+    {
+        entry = decode_table.func7_row[entry & ~DECODE_BY_FUNC7][word >> 25];
+    }
+    if (entry == 0)
+    {
+        return false;
+    }
+
+    const InstructionSpec &spec = instruction_set[entry - 1];
+    d.operation = spec.operation;
+    d.alu_control_signal = spec.alu_control_signal;
+    d.format = spec.format;
+    d.rd = (word >> 7) & 0x1f;
+    d.rs1 = (word >> 15) & 0x1f;
+    d.rs2 = (word >> 20) & 0x1f;
+    d.imm = 0;
+
+    switch (spec.format)
+    {
+    case FORMAT_R:
+    case FORMAT_A:
+        // AMOs and LR/SC use the R-type layout; aq/rl sit in funct7 and are ignored
+        break;
+    case FORMAT_I:
+        d.imm = sign_extend(word >> 20, 12);
+        break;
+    case FORMAT_S:
+        d.imm = sign_extend(((word >> 25) << 5) | ((word >> 7) & 0x1f), 12);
+        break;
+    case FORMAT_SB:
+        // Branch immediate format is complex in RISC-V
+        d.imm = sign_extend(((word >> 31) << 12) | (((word >> 7) & 0x1) << 11) |
+                            (((word >> 25) & 0x3f) << 5) | (((word >> 8) & 0xf) << 1), 13);
+        break;
+    case FORMAT_U:
+        // Add 12 zeros to the right (shift left by 12)
+        d.imm = static_cast<int32_t>(word & 0xfffff000);
+        break;
+    case FORMAT_UJ:
+        // JAL immediate format is complex in RISC-V
+        d.imm = sign_extend(((word >> 31) << 20) | (((word >> 12) & 0xff) << 12) |
+                            (((word >> 20) & 0x1) << 11) | (((word >> 21) & 0x3ff) << 1), 21);
+        break;
+    }
+    return true;
+}
+// Returns the decoded record for the instruction at pc, decoding it on first use.
+// word-aligned instructions are cached on their page until a store overwrites them.
+const DecodedInstruction *Memory::lookup_decoded(uint32_t pc, uint32_t word)
+{
+    thread_local DecodedInstruction uncached;
+
+    Page *page = find_page(pc);
+    if (!page || (pc & 3))
+    {
+        return decode_instruction(word, uncached) ? &uncached : nullptr;
+    }
+
+    DecodedInstruction *decoded = __atomic_load_n(&page->decoded, __ATOMIC_ACQUIRE);
+    if (decoded)
+    {
+        DecodedInstruction &d = decoded[(pc & PAGE_MASK) >> 2];
+        if (__atomic_load_n(&d.alu_control_signal, __ATOMIC_ACQUIRE) >= 0)
+        {
+            return &d;
+        }
+    }
+
+    // other harts may fill the same page at the same time: allocate and fill
+    // under the lock, and publish a record only once all of it is written
+    unique_lock<mutex> guard(lock, defer_lock);
+    if (shared)
+    {
+        guard.lock();
+    }
+    if (!page->decoded)
+    {
+        decoded = new DecodedInstruction[PAGE_SIZE / 4];
+        for (uint32_t i = 0; i < PAGE_SIZE / 4; i++)
+        {
+            decoded[i].alu_control_signal = -1;
+        }
+        __atomic_store_n(&page->decoded, decoded, __ATOMIC_RELEASE);
+    }
+
+    DecodedInstruction &record = page->decoded[(pc & PAGE_MASK) >> 2];
+    if (record.alu_control_signal >= 0)
+    {
+        return &record;
+    }
+    DecodedInstruction filled;
+    if (!decode_instruction(word, filled))
+    {
+        return nullptr;
+    }
+    int8_t alu_control_signal = filled.alu_control_signal;
+    filled.alu_control_signal = -1;
+    record = filled;
+    __atomic_store_n(&record.alu_control_signal, alu_control_signal, __ATOMIC_RELEASE);
+    return &record;
+}
+
+// Decode stage: Identify instruction type and extract operands
+void Hart::decode()
+{
+    // instruction to end the simulation
+    if (instruction_word == 0)
     {
-        cout << "ERROR: Unidentifiable machine code!" << endl;
+        TRACE_AT(TRACE_SUMMARY) << "Finished Simulation" << '\n'
+             << '\n';
+        halted = true;
         swi_exit();
         return;
     }
-}
 
-// Helper function to perform binary operations
-string performBinaryOp(const std::string& op1, const std::string& op2, 
-    function<int(int, int)> operation) {
-    int result = operation(nint(op1, 16), nint(op2, 16));
-    return nhex(result);
+    const DecodedInstruction *d = memory.lookup_decoded(PC, instruction_word);
+    if (!d)
+    {
+        trace_out << "ERROR: Invalid machine code" << '\n';
+        swi_exit();
+        return;
+    }
+
+    operation = d->operation;
+    alu_control_signal = d->alu_control_signal;
+    is_mem[0] = -1;
+    is_mem[1] = -1;
+
+    unsigned int rs1 = d->rs1;
+    unsigned int rs2 = d->rs2;
+    rd = d->rd;
+
+    // Extract operands based on instruction type
+    if (d->format == FORMAT_R)
+    {
+        // Read values from registers
+        operand1 = X[rs1];
+        operand2 = X[rs2];
+        write_back_signal = true;
+
+        TRACE(TRACE_DECODE) << "DECODE: Identified " << operation << " operation | Source: X" 
+        << rs1 << " (0x" << nhex(operand1) << "), X" 
+        << rs2 << " (0x" << nhex(operand2) << ") | Destination Register: X" 
+        << rd << '\n';
+
+        TRACE(TRACE_DECODE) << "DECODE: Read source registers: X" << rs1 << " -> "
+             << static_cast<int32_t>(operand1) << ", X" << rs2 << " -> "
+             << static_cast<int32_t>(operand2) << '\n';
+    }
+    else if (d->format == FORMAT_I)
+    {
+        immediate = d->imm;
+
+        operand1 = X[rs1];
+        operand2 = static_cast<uint32_t>(immediate);
+        write_back_signal = true;
+
+        TRACE(TRACE_DECODE) << "DECODE: Identified " << operation << "operation | Source: X"
+             << rs1 << "| immediate is " << immediate
+             << "| Destination Register: X" << rd << '\n';
+
+        TRACE(TRACE_DECODE) << "DECODE: Read source registers: X" << rs1 << " -> "
+             << static_cast<int32_t>(operand1) << '\n';
+    }
+    else if (d->format == FORMAT_S)
+    {
+        immediate = d->imm;
+
+        operand1 = X[rs1];
+        operand2 = static_cast<uint32_t>(immediate);
+        register_data = X[rs2];
+        write_back_signal = false;
+
+        TRACE(TRACE_DECODE) << "DECODE: Identified " << operation << "operation | Source: X"
+             << rs1 << "| immediate is " << immediate
+             << "| Destination Register: X" << rs2 << '\n';
+
+        TRACE(TRACE_DECODE) << "DECODE: Read source registers: X" << rs1 << " -> "
+             << static_cast<int32_t>(operand1) << ", X" << rs2 << " -> "
+             << static_cast<int32_t>(register_data) << '\n';
+    }
+    else if (d->format == FORMAT_SB)
+    {
+        operand1 = X[rs1];
+        operand2 = X[rs2];
+        offset = d->imm;
+        write_back_signal = false;
+
+        TRACE(TRACE_DECODE) << "DECODE: Identified " << operation << " operation | Compare: X" 
+     << rs1 << " (0x" << nhex(operand1) << ") with X" 
+     << rs2 << " (0x" << nhex(operand2) << ") | Branch offset: " 
+     << offset << '\n';
+
+        TRACE(TRACE_DECODE) << "DECODE: Read source registers: X" << rs1 << " -> "
+             << static_cast<int32_t>(operand1) << ", X" << rs2 << " -> "
+             << static_cast<int32_t>(operand2) << '\n';
+    }
+    else if (d->format == FORMAT_U)
+    {
+        write_back_signal = true;
+
+        TRACE(TRACE_DECODE) << "DECODE: Identified " << operation << "operation | immediate is "
+             << (d->imm >> 12) << "| Destination register X"
+             << rd << '\n';
+
+        operand2 = static_cast<uint32_t>(d->imm);
+    }
+    else if (d->format == FORMAT_UJ)
+    {
+        offset = d->imm;
+        write_back_signal = true;
+
+        TRACE(TRACE_DECODE) << "DECODE: Identified " << operation << "operation | immediate is "
+             << (offset >> 1) << "| Destination register X"
+             << rd << '\n';
+    }
+    else if (d->format == FORMAT_A)
+    {
+        // the address comes from rs1, the value to store or combine from rs2
+        operand1 = X[rs1];
+        register_data = X[rs2];
+        write_back_signal = true;
+
+        TRACE(TRACE_DECODE) << "DECODE: Identified " << operation << " operation | Address: X"
+             << rs1 << " (" << nhex(operand1) << "), Source: X"
+             << rs2 << " (" << nhex(register_data) << ") | Destination Register: X"
+             << rd << '\n';
+    }
 }
 
 // Helper function for handling shifts
-string performShift(const std::string& op1, const std::string& op2, 
-    function<string(int, int)> shiftOperation) {
-    if (nint(op2, 16) < 0) {
-    std::cout << "ERROR: Shift by negative!\n" << std::endl;
+bool Hart::checkShiftAmount(uint32_t amount) {
+    if (static_cast<int32_t>(amount) < 0) {
+    trace_out << "ERROR: Shift by negative!\n" << '\n';
+    swi_exit();
+    return false;
+    }
+    return true;
+}
+
+// Helper function for LR/SC and AMO addresses, which must be word-aligned
+bool Hart::checkAtomicAlignment(uint32_t address) {
+    if (address & 3) {
+    trace_out << "ERROR: Misaligned atomic access!\n" << '\n';
     swi_exit();
-    return "";
+    return false;
     }
-    return shiftOperation(std::stoi(op1, nullptr, 16), std::stoi(op2, nullptr, 16));
+    return true;
 }
 
-// Helper function for arithmetic right shift
-string arithmeticRightShift(int value, int shift) {
-    int result = value >> shift;
-    string bin_value = std::bitset<32>(result).to_string();
+// Performs the LR/SC or AMO operation op (alu_control_signal 32 to 42) on the
+// word at address and returns the value written to rd. the word is accessed
+// with host atomics, so harts on other threads see each operation whole.
+uint32_t Hart::atomic_memory_operation(int op, uint32_t address, uint32_t value)
+{
+    if (op == 32) // lr.w: a load that leaves a reservation, never allocates a page
+    {
+        Page *page = memory.find_page(address);
+        uint32_t loaded = page ? __atomic_load_n(reinterpret_cast<uint32_t *>(page->data + (address & PAGE_MASK)), __ATOMIC_SEQ_CST) : 0;
+        memory.mark_present(address, 4, false);
+        reservation_address = address;
+        reservation_value = loaded;
+        return loaded;
+    }
 
-    // Check if the original value was negative (check the MSB)
-    if ((value & 0x80000000) != 0) {
-    // Fill with 1s for sign extension
-        for (int i = 0; i < shift; i++) {
-        bin_value = '1' + bin_value;
+    uint32_t *word = reinterpret_cast<uint32_t *>(memory.get_page(address)->data + (address & PAGE_MASK));
+    uint32_t old;
+    switch (op)
+    {
+    case 33: // sc.w: 0 if the store happened, 1 if it did not
+    {
+        bool reserved = (reservation_address == address);
+        reservation_address = NO_RESERVATION;
+        old = reservation_value;
+        if (!reserved || !__atomic_compare_exchange_n(word, &old, value, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            return 1;
         }
+        memory.mark_present(address, 4, true);
+        return 0;
+    }
+    case 34: old = __atomic_exchange_n(word, value, __ATOMIC_SEQ_CST); break;
+    case 35: old = __atomic_fetch_add(word, value, __ATOMIC_SEQ_CST); break;
+    case 36: old = __atomic_fetch_xor(word, value, __ATOMIC_SEQ_CST); break;
+    case 37: old = __atomic_fetch_and(word, value, __ATOMIC_SEQ_CST); break;
+    case 38: old = __atomic_fetch_or(word, value, __ATOMIC_SEQ_CST); break;
+    default: // amomin, amomax, amominu, amomaxu
+    {
+        old = __atomic_load_n(word, __ATOMIC_RELAXED);
+        uint32_t next;
+        do
+        {
+            bool less = (op == 39 || op == 40) ? static_cast<int32_t>(value) < static_cast<int32_t>(old) : value < old;
+            next = ((op == 39 || op == 41) == less) ? value : old;
+        } while (!__atomic_compare_exchange_n(word, &old, next, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+        break;
+    }
     }
-    return nhex(std::stoi(bin_value, nullptr, 2));
+    memory.mark_present(address, 4, true);
+    return old;
 }
 
 // Helper function for setting memory access mode
-void setMemoryAccess(int address, int accessType, int width) {
+void Hart::setMemoryAccess(uint32_t address, int accessType, int width) {
     memory_address = address;
     is_mem[0] = accessType;
     is_mem[1] = width;
 }
 
-// Helper function for branch operations
-bool evaluateBranchCondition(const std::string& op1, const std::string& op2, 
-     function<bool(int, int)> condition) {
-     return condition(nint(op1, 16), nint(op2, 16));
+// Log R-type and branch operations
+void Hart::logBinaryOperation() {
+    TRACE(TRACE_EXECUTE) << "EXECUTE: " << operation << " " << static_cast<int32_t>(operand1) << " and " << static_cast<int32_t>(operand2) << '\n';
 }
 
-// Helper function for address calculation
-int calculateAddress(const std::string& base, const std::string& offset) {
-    return stoi(base, nullptr, 16) + nint(offset, 2, offset.length());
-}
-
-// Helper function to handle immediate operations 
-string performImmediateOp(const std::string& op1, const std::string& op2, 
-       function<int(int, int)> operation) {
-       return nhex(operation(std::stoi(op1, nullptr, 16), nint(op2, 2, op2.length())));
+// Log address calculation of loads and stores
+void Hart::logAddressOperation() {
+    TRACE(TRACE_EXECUTE) << "EXECUTE: " << "ADD" << " " << static_cast<int32_t>(operand1) << " and " << immediate << '\n';
 }
 
 // Log shift operations
-void logShiftOperation(const std::string& value, int shift, bool withAdd = false) {
-    std::string message = "EXECUTE: Shift left " + std::to_string(std::stoi(value.substr(0, 20), 0, 2)) 
-    + " by 12 bits";
+void Hart::logShiftOperation(uint32_t value, bool withAdd) {
+    TRACE(TRACE_EXECUTE) << "EXECUTE: Shift left " << (value >> 12) << " by 12 bits";
     if (withAdd) {
-        message += " and ADD " + to_string(PC + 4);
+        TRACE(TRACE_EXECUTE) << " and ADD " << (PC + 4);
     }
-    cout << message << endl;
+    TRACE(TRACE_EXECUTE) << '\n';
 }
 
 // Main execute function
-void execute() {
+void Hart::execute() {
+    int32_t a = static_cast<int32_t>(operand1);
+    int32_t b = static_cast<int32_t>(operand2);
+
     switch (alu_control_signal) {
         // AND operation
         case 1: {
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a & b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = operand1 & operand2;
+        logBinaryOperation();
         break;
         }
 
         // ADD operation
         case 2: {
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a + b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = operand1 + operand2;
+        logBinaryOperation();
         break;
         }
 
         // OR operation
         case 3: {
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a | b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = operand1 | operand2;
+        logBinaryOperation();
         break;
         }
 
         // SHIFT_LEFT operation
         case 4: {
-        register_data = performShift(operand1, operand2, [](int a, int b) { 
-        return nhex(a << b); 
-        });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        if (!checkShiftAmount(operand2)) return;
+        register_data = operand1 << (operand2 & 0x1f);
+        logBinaryOperation();
         break;
         }
 
         // SET_LESS_THAN operation
         case 5: {
-        register_data = (nint(operand1, 16) < nint(operand2, 16)) ? "0x1" : "0x0";
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = (a < b) ? 1 : 0;
+        logBinaryOperation();
         break;
         }
 
         // SHIFT_RIGHT_ARITHMETIC operation
         case 6: {
-        register_data = performShift(operand1, operand2, [](int a, int b) {
-        return arithmeticRightShift(a, b);
-        });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        if (!checkShiftAmount(operand2)) return;
+        register_data = static_cast<uint32_t>(a >> (operand2 & 0x1f));
+        logBinaryOperation();
         break;
         }
 
         // SHIFT_RIGHT_LOGICAL operation
         case 7: {
-        register_data = performShift(operand1, operand2, [](int a, int b) { 
-        return nhex(a >> b); 
-        });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        if (!checkShiftAmount(operand2)) return;
+        register_data = operand1 >> (operand2 & 0x1f);
+        logBinaryOperation();
         break;
         }
 
         // SUB operation
         case 8: {
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a - b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = operand1 - operand2;
+        logBinaryOperation();
         break;
         }
 
         // XOR operation
         case 9: {
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a ^ b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = operand1 ^ operand2;
+        logBinaryOperation();
         break;
         }
 
         // MUL operation
         case 10: {
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a * b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = operand1 * operand2;
+        logBinaryOperation();
         break;
         }
 
         // DIV operation
         case 11: {
-        if (nint(operand2, 16) == 0) {
-        std::cout << "ERROR: Division by zero!\n" << std::endl;
+        if (b == 0) {
+        trace_out << "ERROR: Division by zero!\n" << '\n';
         swi_exit();
         return;
         }
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a / b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = (a == INT32_MIN && b == -1) ? operand1 : static_cast<uint32_t>(a / b);
+        logBinaryOperation();
         break;
         }
 
         // MOD operation
         case 12: {
-        register_data = performBinaryOp(operand1, operand2, [](int a, int b) { return a % b; });
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        register_data = (b == 0) ? operand1 : (b == -1) ? 0 : static_cast<uint32_t>(a % b);
+        logBinaryOperation();
         break;
         }
 
-        // AND_IMM operation
+        // AND_IMM operation (the 12-bit immediate is zero-extended)
         case 13: {
-        register_data = nhex(std::stoi(operand1, nullptr, 16) & std::stoi(operand2, 0, 2));
-        std::cout << "EXECUTE: AND " << std::stoi(operand1, nullptr, 16) 
-        << " and " << nint(operand2, 2, operand2.length()) << std::endl;
+        register_data = operand1 & (operand2 & 0xfff);
+        TRACE(TRACE_EXECUTE) << "EXECUTE: AND " << a 
+        << " and " << immediate << '\n';
         break;
         }
 
         // ADD_IMM operation
         case 14: {
-        register_data = performImmediateOp(operand1, operand2, [](int a, int b) { return a + b; });
-        std::cout << "EXECUTE: ADD " << std::stoi(operand1, nullptr, 16) 
-        << " and " << nint(operand2, 2, operand2.length()) << std::endl;
+        register_data = operand1 + operand2;
+        TRACE(TRACE_EXECUTE) << "EXECUTE: ADD " << a 
+        << " and " << immediate << '\n';
         break;
         }
 
-        // OR_IMM operation
+        // OR_IMM operation (the 12-bit immediate is zero-extended)
         case 15: {
-        register_data = nhex(std::stoi(operand1, nullptr, 16) | std::stoi(operand2, 0, 2));
-        std::cout << "EXECUTE: OR " << std::stoi(operand1, nullptr, 16) 
-        << " and " << nint(operand2, 2, operand2.length()) << std::endl;
+        register_data = operand1 | (operand2 & 0xfff);
+        TRACE(TRACE_EXECUTE) << "EXECUTE: OR " << a 
+        << " and " << immediate << '\n';
         break;
         }
 
         // LOAD_WORD operation
         case 16: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 0, 0); // load (0), word (0)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 0, 0); // load (0), word (0)
+        logAddressOperation();
         break;
         }
 
         // LOAD_HALF operation
         case 17: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 0, 1); // load (0), half (1)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 0, 1); // load (0), half (1)
+        logAddressOperation();
         break;
         }
 
         // LOAD_BYTE operation
         case 18: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 0, 3); // load (0), byte (3)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 0, 3); // load (0), byte (3)
+        logAddressOperation();
         break;
         }
 
         // JUMP_AND_LINK operation
         case 19: {
-        register_data = nhex(PC + 4);
-        return_address = nint(operand2, 2, operand2.length()) + nint(operand1, 16);
+        register_data = PC + 4;
+        return_address = operand1 + operand2;
         pc_select = 1;
-        cout << "EXECUTE: No execute operation" << endl;
+        TRACE(TRACE_EXECUTE) << "EXECUTE: No execute operation" << '\n';
         break;
         }
 
         // STORE_WORD operation
         case 20: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 1, 0); // store (1), word (0)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 1, 0); // store (1), word (0)
+        logAddressOperation();
         break;
         }
 
         // STORE_BYTE operation
         case 21: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 1, 3); // store (1), byte (3)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 1, 3); // store (1), byte (3)
+        logAddressOperation();
         break;
         }
 
         // STORE_HALF operation
         case 22: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 1, 1); // store (1), half (1)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 1, 1); // store (1), half (1)
+        logAddressOperation();
         break;
         }
 
         // BRANCH_EQUAL operation
         case 23: {
-        if (evaluateBranchCondition(operand1, operand2, [](int a, int b) { return a == b; })) {
-        pc_offset = nint(offset, 2, offset.length());
+        if (a == b) {
+        pc_offset = offset;
         inc_select = 1;
         }
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        logBinaryOperation();
         break;
         }
 
         // BRANCH_NOT_EQUAL operation
         case 24: {
-        if (evaluateBranchCondition(operand1, operand2, [](int a, int b) { return a != b; })) {
-        pc_offset = nint(offset, 2, offset.length());
+        if (a != b) {
+        pc_offset = offset;
         inc_select = 1;
         }
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        logBinaryOperation();
         break;
         }
 
         // BRANCH_GE operation
         case 25: {
-        if (evaluateBranchCondition(operand1, operand2, [](int a, int b) { return a >= b; })) {
-        pc_offset = nint(offset, 2, offset.length());
+        if (a >= b) {
+        pc_offset = offset;
         inc_select = 1;
         }
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        logBinaryOperation();
         break;
         }
 
         // BRANCH_LT operation
         case 26: {
-        if (evaluateBranchCondition(operand1, operand2, [](int a, int b) { return a < b; })) {
-        pc_offset = nint(offset, 2, offset.length());
+        if (a < b) {
+        pc_offset = offset;
         inc_select = 1;
         }
-        cout << "EXECUTE: " << operation << " " << nint(operand1, 16) << " and " << nint(operand2, 16) << endl;
+        logBinaryOperation();
         break;
         }
 
         // AUIPC operation
         case 27: {
-        register_data = nhex(PC + 4 + std::stoi(operand2, 0, 2));
-        std::cout << "EXECUTE: Shift left " << std::stoi(operand2.substr(0, 20), 0, 2) 
-        << " by 12 bits and ADD " << (PC + 4) << std::endl;
+        register_data = PC + 4 + operand2;
+        logShiftOperation(operand2, true);
         break;
         }
 
         // LUI operation
         case 28: {
-        register_data = nhex(std::stoi(operand2, 0, 2));
-        logShiftOperation(operand2, 12);
+        register_data = operand2;
+        logShiftOperation(operand2);
         break;
         }
 
         // JAL operation
         case 29: {
-        register_data = nhex(PC + 4);
-        pc_offset = nint(offset, 2, offset.length());
+        register_data = PC + 4;
+        pc_offset = offset;
         inc_select = 1;
-        cout << "EXECUTE: No execute operation" << endl;
+        TRACE(TRACE_EXECUTE) << "EXECUTE: No execute operation" << '\n';
         break;
         }
 
         // LOAD_UNSIGNED_BYTE operation
         case 30: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 0, 4); // load (0), unsigned byte (4)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 0, 4); // load (0), unsigned byte (4)
+        logAddressOperation();
         break;
         }
 
         // STORE_UNSIGNED_BYTE operation
         case 31: {
-        int address = calculateAddress(operand1, operand2);
-        setMemoryAccess(address, 1, 4); // store (1), unsigned byte (4)
-        cout << "EXECUTE: " << "ADD" << " " << stoi(operand1, nullptr, 16) << " and " << nint(operand2, 2, operand2.length()) << endl;
+        setMemoryAccess(operand1 + operand2, 1, 4); // store (1), unsigned byte (4)
+        logAddressOperation();
         break;
         }
-    }
 
-    if (register_data.length() > 10) {
-    register_data = register_data.substr(0, 2) + register_data.substr(register_data.length() - 8);
-    } //to format the register data to correct size.
-
-    register_data = register_data.substr(0, 2) +
-    string(10 - register_data.length(), '0') +
-    register_data.substr(2); //this is to zero-pad the register data
+        // LR/SC and AMO operations: the address is rs1 as it is, the memory stage does the rest
+        case 32: case 33: case 34: case 35: case 36: case 37:
+        case 38: case 39: case 40: case 41: case 42: {
+        if (!checkAtomicAlignment(operand1)) return;
+        setMemoryAccess(operand1, 2, 3); // atomic (2), word (3)
+        TRACE(TRACE_EXECUTE) << "EXECUTE: Atomic access at memory address " << nhex(operand1) << '\n';
+        break;
+        }
+    }
 }
 
 
 // Performs the memory operations and also performs the operations of IAG.
-void mem()
+void Hart::mem()
 {
+    // number of bytes moved for each width code
+    int width_bytes = (is_mem[1] == 0) ? 1 : (is_mem[1] == 1) ? 2 : (is_mem[1] == 3) ? 4 : 8;
+    const char *width_name = (is_mem[1] == 0) ? "byte" : (is_mem[1] == 1) ? "half-word" : (is_mem[1] == 3) ? "word" : "doubleword";
+
     if (is_mem[0] == -1) // check if there is no memory operation
     {
-        cout << "MEMORY: Memory stage bypassed (no load/store operations)" << endl;
+        TRACE(TRACE_MEMORY) << "MEMORY: Memory stage bypassed (no load/store operations)" << '\n';
     }
     else if (is_mem[0] == 0) // handle load operation
     {
-        // ensure memory is initialized before reading
-        if (MEM.find(memory_address) == MEM.end())
+        // loaded values are zero-extended. the bytes read are reported in memory.mc.
+        register_data = (width_bytes == 1) ? memory.read_mem_byte(memory_address) :
+                        (width_bytes == 2) ? memory.read_mem_half(memory_address) : memory.read_mem_word(memory_address);
+        memory.mark_present(memory_address, width_bytes, false);
+
+        TRACE(TRACE_MEMORY) << "MEMORY: Load " << width_name
+                  << static_cast<int32_t>(register_data) << " from  memory address" << hex << memory_address << dec << '\n';
+    }
+    else if (is_mem[0] == 2) // handle LR/SC and AMO operations
+    {
+        register_data = atomic_memory_operation(alu_control_signal, memory_address, register_data);
+
+        TRACE(TRACE_MEMORY) << "MEMORY: " << operation << " at memory address " << hex << memory_address << dec
+                  << " returned " << static_cast<int32_t>(register_data) << '\n';
+    }
+    else // handle store operation
+    {
+        // store the low bytes of the register, a double-word is zero-extended
+        if (width_bytes == 1)
+        {
+            memory.write_mem_byte(memory_address, register_data & 0xff);
+        }
+        else if (width_bytes == 2)
+        {
+            memory.write_mem_half(memory_address, register_data & 0xffff);
+        }
+        else
+        {
+            memory.write_mem_word(memory_address, register_data);
+            if (width_bytes == 8)
+            {
+                memory.write_mem_word(memory_address + 4, 0);
+            }
+        }
+
+        TRACE(TRACE_MEMORY) << "MEMORY: Store" << width_name
+                  << static_cast<int32_t>(register_data) << " to memory address" << hex << memory_address << dec << '\n';
+    }
+
+    // the coherence model and the caches see every data access; atomics other than lr.w count as stores
+    if (memory.coherence && is_mem[0] != -1)
+    {
+        memory.coherence->access(id, memory_address, width_bytes,
+                                 is_mem[0] == 1 || (is_mem[0] == 2 && alu_control_signal != 32));
+    }
+    memory_stall = (caches && is_mem[0] != -1) ?
+                   caches->data(memory_address, width_bytes, is_mem[0] == 1 || (is_mem[0] == 2 && alu_control_signal != 32)) : 0;
+
+    // update pc according to control signals
+    if (pc_select)
+    {
+        PC = return_address;
+    }
+    else if (inc_select)
+    {
+        PC += pc_offset;
+    }
+    else
+    {
+        PC += 4;
+    }
+}
+
+// Writes the results back to the register file
+void Hart::write_back()
+{
+    if (write_back_signal)
+    {
+        if (rd != 0)
+        {
+            X[rd] = register_data;
+            X_written |= 1u << rd;
+            TRACE(TRACE_WRITEBACK) << "WRITEBACK: Register X" << rd << " updated with value 0x" << nhex(register_data) << '\n';
+        }
+        else
+        {
+            TRACE(TRACE_WRITEBACK) << "WRITEBACK: no change: zero register is read-only" << '\n';
+        }
+    }
+    else
+    {
+        TRACE(TRACE_WRITEBACK) << "WRITEBACK: Write-back stage bypassed (no destination register)" << '\n';
+    }
+}
+
+// Returns the decoded record for the instruction at pc for run_RISCVsim_fast(),
+// or nullptr (after printing why) when the program ends or the word is not valid.
+inline const DecodedInstruction *Hart::fetch_decoded(uint32_t pc)
+{
+    Page *page = memory.find_page(pc);
+    const DecodedInstruction *decoded = page ? __atomic_load_n(&page->decoded, __ATOMIC_ACQUIRE) : nullptr;
+    if (decoded && !(pc & 3))
+    {
+        const DecodedInstruction *d = &decoded[(pc & PAGE_MASK) >> 2];
+        if (__atomic_load_n(&d->alu_control_signal, __ATOMIC_ACQUIRE) >= 0)
+        {
+            return d;
+        }
+    }
+
+    uint32_t word = memory.read_mem_word(pc);
+    if (word == 0)
+    {
+        TRACE_AT(TRACE_SUMMARY) << "Finished Simulation" << '\n'
+             << '\n';
+        halted = true;
+        return nullptr;
+    }
+
+    const DecodedInstruction *d = memory.lookup_decoded(pc, word);
+    if (!d)
+    {
+        trace_out << "ERROR: Invalid machine code" << '\n';
+    }
+    return d;
+}
+
+// Fast engine: the same instruction semantics as fetch() ... write_back(), but
+// without the stage latches or trace. every handler retires its instruction and
+// jumps straight to the handler of the next one through a computed goto
+// (direct threading, a GCC/Clang extension), indexed by alu_control_signal.
+void Hart::run_RISCVsim_fast()
+{
+    static void *const handlers[43] = {
+        &&invalid, &&op_and, &&op_add, &&op_or, &&op_sll, &&op_slt, &&op_sra, &&op_srl,
+        &&op_sub, &&op_xor, &&op_mul, &&op_div, &&op_rem, &&op_andi, &&op_addi, &&op_ori,
+        &&op_lb, &&op_lh, &&op_lw, &&op_jalr, &&op_sb, &&op_sw, &&op_sh, &&op_beq,
+        &&op_bne, &&op_bge, &&op_blt, &&op_auipc, &&op_lui, &&op_jal, &&op_ld, &&op_sd,
+        &&op_amo, &&op_amo, &&op_amo, &&op_amo, &&op_amo, &&op_amo, &&op_amo, &&op_amo,
+        &&op_amo, &&op_amo, &&op_amo};
+
+    uint32_t pc = PC;
+    const DecodedInstruction *d;
+    uint32_t rs1, rs2;
+
+#define DISPATCH()                               \
+    do                                           \
+    {                                            \
+        d = fetch_decoded(pc);                   \
+        if (!d)                                  \
+            goto stop;                           \
+        rs1 = X[d->rs1];                         \
+        rs2 = X[d->rs2];                         \
+        goto *handlers[d->alu_control_signal];   \
+    } while (0)
+
+#define WRITE_RD(value)                          \
+    do                                           \
+    {                                            \
+        if (d->rd != 0)                          \
+        {                                        \
+            X[d->rd] = (value);                  \
+            X_written |= 1u << d->rd;            \
+        }                                        \
+    } while (0)
+
+#define RETIRE(next_pc)                          \
+    do                                           \
+    {                                            \
+        pc = (next_pc);                          \
+        clock_cycles++;                          \
+        if (clock_cycles >= stop_cycle ||        \
+            pc == stop_pc)                       \
+            goto pause;                          \
+        DISPATCH();                              \
+    } while (0)
+
+// ends the basic block at a branch or jump, for the basic-block vectors of --simpoint
+#define RETIRE_BRANCH(next_pc)                                        \
+    do                                                                \
+    {                                                                 \
+        uint32_t next = (next_pc);                                    \
+        if (profile)                                                  \
+            profile->end_block(next, clock_cycles + 1);               \
+        RETIRE(next);                                                 \
+    } while (0)
+
+#define SHIFT_AMOUNT_CHECK()                                          \
+    do                                                                \
+    {                                                                 \
+        if (static_cast<int32_t>(rs2) < 0)                            \
+        {                                                             \
+            trace_out << "ERROR: Shift by negative!\n\n";            \
+            goto stop;                                                \
+        }                                                             \
+    } while (0)
+
+    DISPATCH();
+
+op_and:   WRITE_RD(rs1 & rs2); RETIRE(pc + 4);
+op_add:   WRITE_RD(rs1 + rs2); RETIRE(pc + 4);
+op_or:    WRITE_RD(rs1 | rs2); RETIRE(pc + 4);
+op_sll:   SHIFT_AMOUNT_CHECK(); WRITE_RD(rs1 << (rs2 & 0x1f)); RETIRE(pc + 4);
+op_slt:   WRITE_RD(static_cast<int32_t>(rs1) < static_cast<int32_t>(rs2) ? 1 : 0); RETIRE(pc + 4);
+op_sra:   SHIFT_AMOUNT_CHECK(); WRITE_RD(static_cast<uint32_t>(static_cast<int32_t>(rs1) >> (rs2 & 0x1f))); RETIRE(pc + 4);
+op_srl:   SHIFT_AMOUNT_CHECK(); WRITE_RD(rs1 >> (rs2 & 0x1f)); RETIRE(pc + 4);
+op_sub:   WRITE_RD(rs1 - rs2); RETIRE(pc + 4);
+op_xor:   WRITE_RD(rs1 ^ rs2); RETIRE(pc + 4);
+op_mul:   WRITE_RD(rs1 * rs2); RETIRE(pc + 4);
+op_div:
+    {
+        int32_t a = static_cast<int32_t>(rs1), b = static_cast<int32_t>(rs2);
+        if (b == 0)
+        {
+            trace_out << "ERROR: Division by zero!\n" << '\n';
+            goto stop;
+        }
+        WRITE_RD((a == INT32_MIN && b == -1) ? rs1 : static_cast<uint32_t>(a / b));
+        RETIRE(pc + 4);
+    }
+op_rem:
+    {
+        int32_t a = static_cast<int32_t>(rs1), b = static_cast<int32_t>(rs2);
+        WRITE_RD((b == 0) ? rs1 : (b == -1) ? 0 : static_cast<uint32_t>(a % b));
+        RETIRE(pc + 4);
+    }
+op_andi:  WRITE_RD(rs1 & (d->imm & 0xfff)); RETIRE(pc + 4);
+op_addi:  WRITE_RD(rs1 + d->imm); RETIRE(pc + 4);
+op_ori:   WRITE_RD(rs1 | (d->imm & 0xfff)); RETIRE(pc + 4);
+op_lb:
+    {
+        uint32_t address = rs1 + d->imm;
+        uint32_t value = memory.read_mem_byte(address);
+        memory.mark_present(address, 1, false);
+        WRITE_RD(value);
+        RETIRE(pc + 4);
+    }
+op_lh:
+    {
+        uint32_t address = rs1 + d->imm;
+        uint32_t value = memory.read_mem_half(address);
+        memory.mark_present(address, 2, false);
+        WRITE_RD(value);
+        RETIRE(pc + 4);
+    }
+op_lw:
+    {
+        uint32_t address = rs1 + d->imm;
+        uint32_t value = memory.read_mem_word(address);
+        memory.mark_present(address, 4, false);
+        WRITE_RD(value);
+        RETIRE(pc + 4);
+    }
+op_ld:
+    {
+        uint32_t address = rs1 + d->imm;
+        uint32_t value = memory.read_mem_word(address);
+        memory.mark_present(address, 8, false);
+        WRITE_RD(value);
+        RETIRE(pc + 4);
+    }
+op_jalr:
+    {
+        uint32_t target = rs1 + d->imm;
+        WRITE_RD(pc + 4);
+        RETIRE_BRANCH(target);
+    }
+op_sb:    memory.write_mem_byte(rs1 + d->imm, rs2 & 0xff); RETIRE(pc + 4);
+op_sh:    memory.write_mem_half(rs1 + d->imm, rs2 & 0xffff); RETIRE(pc + 4);
+op_sw:    memory.write_mem_word(rs1 + d->imm, rs2); RETIRE(pc + 4);
+op_sd:    memory.write_mem_word(rs1 + d->imm, rs2); memory.write_mem_word(rs1 + d->imm + 4, 0); RETIRE(pc + 4);
+op_beq:   RETIRE_BRANCH(rs1 == rs2 ? pc + d->imm : pc + 4);
+op_bne:   RETIRE_BRANCH(rs1 != rs2 ? pc + d->imm : pc + 4);
+op_bge:   RETIRE_BRANCH(static_cast<int32_t>(rs1) >= static_cast<int32_t>(rs2) ? pc + d->imm : pc + 4);
+op_blt:   RETIRE_BRANCH(static_cast<int32_t>(rs1) < static_cast<int32_t>(rs2) ? pc + d->imm : pc + 4);
+op_auipc: WRITE_RD(pc + 4 + d->imm); RETIRE(pc + 4);
+op_lui:   WRITE_RD(d->imm); RETIRE(pc + 4);
+op_jal:   WRITE_RD(pc + 4); RETIRE_BRANCH(pc + d->imm);
+op_amo:
+    {
+        if (rs1 & 3)
+        {
+            trace_out << "ERROR: Misaligned atomic access!\n" << '\n';
+            goto stop;
+        }
+        uint32_t value = atomic_memory_operation(d->alu_control_signal, rs1, rs2);
+        WRITE_RD(value);
+        RETIRE(pc + 4);
+    }
+
+invalid:
+    trace_out << "ERROR: Invalid machine code" << '\n';
+
+stop:
+    PC = pc;
+    swi_exit();
+    return;
+
+pause:
+    PC = pc;
+
+#undef DISPATCH
+#undef WRITE_RD
+#undef RETIRE
+#undef RETIRE_BRANCH
+#undef SHIFT_AMOUNT_CHECK
+}
+
+// Basic-block translation cache used by run_RISCVsim_blocks(). a block is a
+// straight-line run of predecoded instructions that ends at a branch, jal or
+// jalr (or after MAX_BLOCK_OPS). blocks link to the blocks that followed them
+// last time, so hot paths go from block to block without a cache lookup.
+const int MAX_BLOCK_OPS = 64;
+
+// Invalidates every block holding the instruction at address
+void Hart::invalidate_blocks(uint32_t address)
+{
+    auto it = blocks_by_page.find(address >> PAGE_SHIFT);
+    if (it == blocks_by_page.end())
+    {
+        return;
+    }
+
+    vector<Block *> &blocks = it->second;
+    for (size_t i = 0; i < blocks.size();)
+    {
+        Block *b = blocks[i];
+        if (address >= b->start_pc && address < b->end_pc)
+        {
+            b->valid = false;
+            blocks_invalidated = true;
+            block_cache.erase(b->start_pc);
+            blocks[i] = blocks.back();
+            blocks.pop_back();
+        }
+        else
         {
-            MEM[memory_address] = "00"; // default initialization
+            i++;
         }
+    }
+}
+
+inline bool ends_block(int alu_control_signal)
+{
+    return alu_control_signal == 19 || alu_control_signal == 29 ||
+           (alu_control_signal >= 23 && alu_control_signal <= 26);
+}
+
+// Returns the block starting at pc, translating it on a miss.
+// returns nullptr if there is no instruction to run at pc.
+Block *Hart::lookup_block(uint32_t pc)
+{
+    block_lookups++;
+    auto it = block_cache.find(pc);
+    if (it != block_cache.end())
+    {
+        block_lookup_hits++;
+        return it->second;
+    }
 
-        // load byte
-        if (is_mem[1] == 0)
+    unique_ptr<Block> b(new Block());
+    b->start_pc = pc;
+    b->valid = true;
+    uint32_t address = pc;
+    while ((int)b->ops.size() < MAX_BLOCK_OPS)
+    {
+        uint32_t word = memory.read_mem_word(address);
+        const DecodedInstruction *d = word ? memory.lookup_decoded(address, word) : nullptr;
+        if (!d)
+        {
+            break;
+        }
+        b->ops.push_back(*d);
+        if (d->format != FORMAT_S && d->format != FORMAT_SB && d->rd != 0)
         {
-            register_data = "0x" + MEM[memory_address];
+            b->rd_mask |= 1u << d->rd;
         }
-        // load half-word
-        else if (is_mem[1] == 1)
+        address += 4;
+        if (ends_block(d->alu_control_signal))
         {
-            for (int i = 0; i < 2; i++)
+            break;
+        }
+    }
+    if (b->ops.empty())
+    {
+        return nullptr;
+    }
+    b->end_pc = address;
+
+    Block *block = b.get();
+    block_storage.push_back(move(b));
+    block_cache[pc] = block;
+    for (uint32_t page = pc >> PAGE_SHIFT; page <= (address - 1) >> PAGE_SHIFT; page++)
+    {
+        blocks_by_page[page].push_back(block);
+    }
+    return block;
+}
+
+// Executes one micro-op of a block and moves pc to the next instruction.
+// OP_EXIT leaves the block after a store into translated code; OP_STOP ends
+// the program with pc still at the instruction that could not complete.
+inline MicroOpResult Hart::execute_micro_op(const DecodedInstruction &d, uint32_t &pc)
+{
+    uint32_t rs1 = X[d.rs1];
+    uint32_t rs2 = X[d.rs2];
+    int32_t a = static_cast<int32_t>(rs1);
+    int32_t b = static_cast<int32_t>(rs2);
+    uint32_t next_pc = pc + 4;
+    uint32_t value = 0;
+    bool write = true;
+
+    switch (d.alu_control_signal)
+    {
+    case 1: value = rs1 & rs2; break;
+    case 2: value = rs1 + rs2; break;
+    case 3: value = rs1 | rs2; break;
+    case 4:
+    case 6:
+    case 7:
+        if (b < 0)
+        {
+            trace_out << "ERROR: Shift by negative!\n" << '\n';
+            return OP_STOP;
+        }
+        value = (d.alu_control_signal == 4) ? rs1 << (rs2 & 0x1f) :
+                (d.alu_control_signal == 6) ? static_cast<uint32_t>(a >> (rs2 & 0x1f)) : rs1 >> (rs2 & 0x1f);
+        break;
+    case 5: value = (a < b) ? 1 : 0; break;
+    case 8: value = rs1 - rs2; break;
+    case 9: value = rs1 ^ rs2; break;
+    case 10: value = rs1 * rs2; break;
+    case 11:
+        if (b == 0)
+        {
+            trace_out << "ERROR: Division by zero!\n" << '\n';
+            return OP_STOP;
+        }
+        value = (a == INT32_MIN && b == -1) ? rs1 : static_cast<uint32_t>(a / b);
+        break;
+    case 12: value = (b == 0) ? rs1 : (b == -1) ? 0 : static_cast<uint32_t>(a % b); break;
+    case 13: value = rs1 & (d.imm & 0xfff); break;
+    case 14: value = rs1 + d.imm; break;
+    case 15: value = rs1 | (d.imm & 0xfff); break;
+    case 16: value = memory.read_mem_byte(rs1 + d.imm); memory.mark_present(rs1 + d.imm, 1, false); break;
+    case 17: value = memory.read_mem_half(rs1 + d.imm); memory.mark_present(rs1 + d.imm, 2, false); break;
+    case 18: value = memory.read_mem_word(rs1 + d.imm); memory.mark_present(rs1 + d.imm, 4, false); break;
+    case 30: value = memory.read_mem_word(rs1 + d.imm); memory.mark_present(rs1 + d.imm, 8, false); break;
+    case 19: value = pc + 4; next_pc = rs1 + d.imm; break;
+    case 20: memory.write_mem_byte(rs1 + d.imm, rs2 & 0xff); write = false; break;
+    case 22: memory.write_mem_half(rs1 + d.imm, rs2 & 0xffff); write = false; break;
+    case 21: memory.write_mem_word(rs1 + d.imm, rs2); write = false; break;
+    case 31: memory.write_mem_word(rs1 + d.imm, rs2); memory.write_mem_word(rs1 + d.imm + 4, 0); write = false; break;
+    case 23: next_pc = (a == b) ? pc + d.imm : pc + 4; write = false; break;
+    case 24: next_pc = (a != b) ? pc + d.imm : pc + 4; write = false; break;
+    case 25: next_pc = (a >= b) ? pc + d.imm : pc + 4; write = false; break;
+    case 26: next_pc = (a < b) ? pc + d.imm : pc + 4; write = false; break;
+    case 27: value = pc + 4 + d.imm; break;
+    case 28: value = d.imm; break;
+    case 29: value = pc + 4; next_pc = pc + d.imm; break;
+    case 32: case 33: case 34: case 35: case 36: case 37:
+    case 38: case 39: case 40: case 41: case 42:
+        if (rs1 & 3)
+        {
+            trace_out << "ERROR: Misaligned atomic access!\n" << '\n';
+            return OP_STOP;
+        }
+        value = atomic_memory_operation(d.alu_control_signal, rs1, rs2);
+        break;
+    }
+
+    if (write && d.rd != 0)
+    {
+        X[d.rd] = value;
+        X_written |= 1u << d.rd;
+    }
+    pc = next_pc;
+    clock_cycles++;
+    return blocks_invalidated ? OP_EXIT : OP_NEXT;
+}
+
+// x86-64 JIT (--engine jit). a block that has run JIT_THRESHOLD times is
+// compiled to native code that works directly on the hart's X array; loads and
+// stores call the guest memory helpers below with the hart's Memory. the code returns the next pc in
+// the low 32 bits and the number of retired instructions in the high 32 bits.
+// it leaves early when a store hits translated code, or before a shift by a
+// negative amount or a division by 0 or -1, so that the interpreter can take over.
+const int JIT_THRESHOLD = 8;
+const size_t JIT_BUFFER_SIZE = 32 << 20;
+
+uint32_t jit_load_byte(Memory *memory, uint32_t address) { memory->mark_present(address, 1, false); return memory->read_mem_byte(address); }
+uint32_t jit_load_half(Memory *memory, uint32_t address) { memory->mark_present(address, 2, false); return memory->read_mem_half(address); }
+uint32_t jit_load_word(Memory *memory, uint32_t address) { memory->mark_present(address, 4, false); return memory->read_mem_word(address); }
+uint32_t jit_load_double(Memory *memory, uint32_t address) { memory->mark_present(address, 8, false); return memory->read_mem_word(address); }
+void jit_store_byte(Memory *memory, uint32_t address, uint32_t value) { memory->write_mem_byte(address, value & 0xff); }
+void jit_store_half(Memory *memory, uint32_t address, uint32_t value) { memory->write_mem_half(address, value & 0xffff); }
+void jit_store_word(Memory *memory, uint32_t address, uint32_t value) { memory->write_mem_word(address, value); }
+void jit_store_double(Memory *memory, uint32_t address, uint32_t value) { memory->write_mem_word(address, value); memory->write_mem_word(address + 4, 0); }
+
+// Machine code emitter for one block. registers: rbx = X, eax/ecx/edx scratch, rdi/esi/edx helper arguments.
+struct JitEmitter
+{
+    vector<uint8_t> code;
+
+    void bytes(initializer_list<uint8_t> b) { code.insert(code.end(), b); }
+    void imm32(uint32_t v) { for (int i = 0; i < 4; i++) code.push_back(v >> (8 * i)); }
+    void imm64(uint64_t v) { for (int i = 0; i < 8; i++) code.push_back(v >> (8 * i)); }
+    static uint8_t reg(int r) { return static_cast<uint8_t>(4 * r); } // disp8 of Xr from rbx
+
+    void load_eax(int r) { bytes({0x8B, 0x43, reg(r)}); }   // mov eax, [rbx + 4r]
+    void load_ecx(int r) { bytes({0x8B, 0x4B, reg(r)}); }   // mov ecx, [rbx + 4r]
+    void load_edx(int r) { bytes({0x8B, 0x53, reg(r)}); }   // mov edx, [rbx + 4r]
+    void load_esi(int r) { bytes({0x8B, 0x73, reg(r)}); }   // mov esi, [rbx + 4r]
+    void load_rdi(const void *p) { bytes({0x48, 0xBF}); imm64(reinterpret_cast<uintptr_t>(p)); } // mov rdi, p
+    void store_eax(int r) { if (r != 0) bytes({0x89, 0x43, reg(r)}); } // mov [rbx + 4r], eax
+    void store_imm(int r, uint32_t v) { if (r != 0) { bytes({0xC7, 0x43, reg(r)}); imm32(v); } }
+    void call(const void *fn) { bytes({0x48, 0xB8}); imm64(reinterpret_cast<uintptr_t>(fn)); bytes({0xFF, 0xD0}); }
+
+    // return next_pc | retired << 32 (20 bytes)
+    void exit(uint32_t next_pc, uint32_t retired)
+    {
+        bytes({0xB8}); imm32(next_pc);                                    // mov eax, next_pc
+        bytes({0x48, 0xB9}); imm64(static_cast<uint64_t>(retired) << 32); // mov rcx, retired << 32
+        bytes({0x48, 0x09, 0xC8, 0x5B, 0xC3});                            // or rax, rcx; pop rbx; ret
+    }
+    // exit unless the flags satisfy condition code cc (a short jcc over the exit)
+    void exit_unless(uint8_t cc, uint32_t next_pc, uint32_t retired)
+    {
+        bytes({static_cast<uint8_t>(0x70 | cc), 20});
+        exit(next_pc, retired);
+    }
+};
+
+// Compiles a block into the JIT buffer. returns false (and the block stays
+// interpreted) if the host is not x86-64 Linux or the buffer is full.
+bool Hart::jit_compile(Block *b)
+{
+#ifdef JIT_X86_64
+    if (!jit_buffer)
+    {
+        void *p = mmap(nullptr, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            jit_enabled = false;
+            return false;
+        }
+        jit_buffer = static_cast<uint8_t *>(p);
+    }
+
+    const uint8_t CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xC, CC_GE = 0xD;
+    JitEmitter e;
+    e.bytes({0x53, 0x48, 0x89, 0xFB}); // push rbx; mov rbx, rdi
+
+    uint32_t pc = b->start_pc;
+    uint32_t n = b->ops.size();
+    bool jumped = false;
+    for (uint32_t i = 0; i < n; i++, pc += 4)
+    {
+        const DecodedInstruction &d = b->ops[i];
+        switch (d.alu_control_signal)
+        {
+        case 1: e.load_eax(d.rs1); e.bytes({0x23, 0x43, e.reg(d.rs2)}); e.store_eax(d.rd); break; // and
+        case 2: e.load_eax(d.rs1); e.bytes({0x03, 0x43, e.reg(d.rs2)}); e.store_eax(d.rd); break; // add
+        case 3: e.load_eax(d.rs1); e.bytes({0x0B, 0x43, e.reg(d.rs2)}); e.store_eax(d.rd); break; // or
+        case 8: e.load_eax(d.rs1); e.bytes({0x2B, 0x43, e.reg(d.rs2)}); e.store_eax(d.rd); break; // sub
+        case 9: e.load_eax(d.rs1); e.bytes({0x33, 0x43, e.reg(d.rs2)}); e.store_eax(d.rd); break; // xor
+        case 10: e.load_eax(d.rs1); e.bytes({0x0F, 0xAF, 0x43, e.reg(d.rs2)}); e.store_eax(d.rd); break; // imul
+        case 5: // slt: cmp eax, [rs2]; setl al; movzx eax, al
+            e.load_eax(d.rs1);
+            e.bytes({0x3B, 0x43, e.reg(d.rs2), 0x0F, 0x9C, 0xC0, 0x0F, 0xB6, 0xC0});
+            e.store_eax(d.rd);
+            break;
+        case 4:
+        case 6:
+        case 7: // shifts: leave before a negative amount, then shl/sar/shr eax, cl
+            e.bytes({0x83, 0x7B, e.reg(d.rs2), 0x00}); // cmp dword [rs2], 0
+            e.exit_unless(CC_GE, pc, i);
+            e.load_ecx(d.rs2);
+            e.load_eax(d.rs1);
+            e.bytes({0xD3, static_cast<uint8_t>(d.alu_control_signal == 4 ? 0xE0 : d.alu_control_signal == 6 ? 0xF8 : 0xE8)});
+            e.store_eax(d.rd);
+            break;
+        case 11:
+        case 12: // div/rem: leave for a divisor of 0 or -1, then cdq; idiv ecx
+            e.load_ecx(d.rs2);
+            e.bytes({0x8D, 0x51, 0x01, 0x83, 0xFA, 0x01}); // lea edx, [rcx + 1]; cmp edx, 1
+            e.exit_unless(CC_A, pc, i);
+            e.load_eax(d.rs1);
+            e.bytes({0x99, 0xF7, 0xF9});
+            if (d.alu_control_signal == 12)
+            {
+                e.bytes({0x89, 0xD0}); // mov eax, edx
+            }
+            e.store_eax(d.rd);
+            break;
+        case 13: e.load_eax(d.rs1); e.bytes({0x25}); e.imm32(d.imm & 0xfff); e.store_eax(d.rd); break; // andi
+        case 14: e.load_eax(d.rs1); e.bytes({0x05}); e.imm32(d.imm); e.store_eax(d.rd); break;         // addi
+        case 15: e.load_eax(d.rs1); e.bytes({0x0D}); e.imm32(d.imm & 0xfff); e.store_eax(d.rd); break; // ori
+        case 16:
+        case 17:
+        case 18:
+        case 30: // loads: rdi = memory, esi = address
+            e.load_rdi(&memory);
+            e.load_esi(d.rs1);
+            e.bytes({0x81, 0xC6}); e.imm32(d.imm);
+            e.call(d.alu_control_signal == 16 ? (const void *)jit_load_byte :
+                   d.alu_control_signal == 17 ? (const void *)jit_load_half :
+                   d.alu_control_signal == 18 ? (const void *)jit_load_word : (const void *)jit_load_double);
+            e.store_eax(d.rd);
+            break;
+        case 20:
+        case 21:
+        case 22:
+        case 31: // stores: rdi = memory, esi = address, edx = value; leave if the store hit translated code
+            e.load_rdi(&memory);
+            e.load_esi(d.rs1);
+            e.bytes({0x81, 0xC6}); e.imm32(d.imm);
+            e.load_edx(d.rs2);
+            e.call(d.alu_control_signal == 20 ? (const void *)jit_store_byte :
+                   d.alu_control_signal == 22 ? (const void *)jit_store_half :
+                   d.alu_control_signal == 21 ? (const void *)jit_store_word : (const void *)jit_store_double);
+            e.bytes({0x48, 0xB8}); e.imm64(reinterpret_cast<uintptr_t>(&blocks_invalidated));
+            e.bytes({0x80, 0x38, 0x00}); // cmp byte [rax], 0
+            e.exit_unless(CC_E, pc + 4, i + 1);
+            break;
+        case 27: e.store_imm(d.rd, pc + 4 + d.imm); break; // auipc
+        case 28: e.store_imm(d.rd, d.imm); break;          // lui
+        case 29: // jal
+            e.store_imm(d.rd, pc + 4);
+            e.exit(pc + d.imm, n);
+            jumped = true;
+            break;
+        case 19: // jalr: target from the old rs1, then link
+            e.load_eax(d.rs1);
+            e.bytes({0x05}); e.imm32(d.imm);
+            e.store_imm(d.rd, pc + 4);
+            e.bytes({0x48, 0xB9}); e.imm64(static_cast<uint64_t>(n) << 32);
+            e.bytes({0x48, 0x09, 0xC8, 0x5B, 0xC3});
+            jumped = true;
+            break;
+        case 23:
+        case 24:
+        case 25:
+        case 26: // branches: cmp eax, ecx; eax = pc + 4; edx = target; cmovcc eax, edx
+        {
+            uint8_t cc = d.alu_control_signal == 23 ? CC_E : d.alu_control_signal == 24 ? CC_NE :
+                         d.alu_control_signal == 25 ? CC_GE : CC_L;
+            e.load_eax(d.rs1);
+            e.load_ecx(d.rs2);
+            e.bytes({0x39, 0xC8, 0xB8}); e.imm32(pc + 4);
+            e.bytes({0xBA}); e.imm32(pc + d.imm);
+            e.bytes({0x0F, static_cast<uint8_t>(0x40 | cc), 0xC2});
+            e.bytes({0x48, 0xB9}); e.imm64(static_cast<uint64_t>(n) << 32);
+            e.bytes({0x48, 0x09, 0xC8, 0x5B, 0xC3});
+            jumped = true;
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    if (!jumped)
+    {
+        e.exit(b->end_pc, n);
+    }
+
+    if (jit_used + e.code.size() > JIT_BUFFER_SIZE)
+    {
+        return false;
+    }
+    memcpy(jit_buffer + jit_used, e.code.data(), e.code.size());
+    b->native = reinterpret_cast<uint64_t (*)(uint32_t *)>(jit_buffer + jit_used);
+    jit_used += (e.code.size() + 15) & ~size_t(15);
+    jit_blocks++;
+    return true;
+#else
+    (void)b;
+    jit_enabled = false;
+    return false;
+#endif
+}
+
+// Block engine: runs translated basic blocks, following block links where it can.
+// with jit_enabled, hot blocks run as native code.
+void Hart::run_RISCVsim_blocks()
+{
+    uint32_t pc = PC;
+    Block *b = lookup_block(pc);
+
+    while (b)
+    {
+        MicroOpResult result = OP_NEXT;
+        size_t first = 0;
+        if (jit_enabled && b->exec_count < JIT_THRESHOLD && ++b->exec_count == JIT_THRESHOLD)
+        {
+            jit_compile(b);
+        }
+        if (b->native)
+        {
+            uint64_t exit = b->native(X);
+            uint32_t retired = exit >> 32;
+            pc = static_cast<uint32_t>(exit);
+            clock_cycles += retired;
+            if (retired == b->ops.size())
+            {
+                X_written |= b->rd_mask;
+            }
+            else
             {
-                if (MEM.find(memory_address + i) == MEM.end())
-                    MEM[memory_address + i] = "00"; // ensure memory exists
+                for (uint32_t i = 0; i < retired; i++)
+                {
+                    const DecodedInstruction &d = b->ops[i];
+                    if (d.format != FORMAT_S && d.format != FORMAT_SB && d.rd != 0)
+                    {
+                        X_written |= 1u << d.rd;
+                    }
+                }
             }
-            register_data = "0x" + MEM[memory_address + 1] + MEM[memory_address];
+            // a stale block stops here; otherwise the interpreter finishes the block
+            first = blocks_invalidated ? b->ops.size() : retired;
+            result = blocks_invalidated ? OP_EXIT : OP_NEXT;
         }
-        // load word
-        else if (is_mem[1] == 3)
+        for (size_t i = first; i < b->ops.size(); i++)
         {
-            for (int i = 0; i < 4; i++)
+            result = execute_micro_op(b->ops[i], pc);
+            if (result != OP_NEXT)
             {
-                if (MEM.find(memory_address + i) == MEM.end())
-                    MEM[memory_address + i] = "00";
+                break;
             }
-            register_data = "0x" + MEM[memory_address + 3] + MEM[memory_address + 2] +
-                            MEM[memory_address + 1] + MEM[memory_address];
         }
-        // load double-word
-        else if (is_mem[1] == 4)
+        if (result == OP_STOP)
+        {
+            break;
+        }
+        blocks_invalidated = false;
+
+        // follow the link for this exit, or look the successor up and link it
+        Block *&link = (pc == b->end_pc) ? b->fall_through : b->taken;
+        if (link && link->valid && link->start_pc == pc)
+        {
+            block_chained++;
+            b = link;
+        }
+        else
         {
-            for (int i = 0; i < 8; i++)
+            b = lookup_block(pc);
+            if (b && result == OP_NEXT && link != b)
             {
-                if (MEM.find(memory_address + i) == MEM.end())
-                    MEM[memory_address + i] = "00";
+                link = b;
             }
-            register_data = "0x" + MEM[memory_address + 7] + MEM[memory_address + 6] +
-                            MEM[memory_address + 5] + MEM[memory_address + 4] +
-                            MEM[memory_address + 3] + MEM[memory_address + 2] +
-                            MEM[memory_address + 1] + MEM[memory_address];
         }
+    }
+
+    if (!b)
+    {
+        fetch_decoded(pc); // prints why the program ended
+    }
+
+    long long entries = block_chained + block_lookups;
+    TRACE_AT(TRACE_SUMMARY) << "Block cache: " << block_cache.size() << " blocks, " << entries << " block entries, "
+         << block_chained << " chained, hit rate " << fixed << setprecision(2)
+         << (entries ? 100.0 * (block_chained + block_lookup_hits) / entries : 0.0) << "%"
+         << defaultfloat << '\n';
+    if (jit_enabled)
+    {
+        TRACE_AT(TRACE_SUMMARY) << "JIT: " << jit_blocks << " blocks compiled, " << jit_used << " bytes of code" << '\n';
+    }
+
+    PC = pc;
+    swi_exit();
+}
+
+// JIT engine: the block engine with hot blocks compiled to x86-64
+void Hart::run_RISCVsim_jit()
+{
+    jit_enabled = true;
+    run_RISCVsim_blocks();
+}
+
+Hart::Hart(Memory &memory) : memory(memory)
+{
+    memory.harts.push_back(this);
+}
+
+Hart::~Hart()
+{
+    close_binary_trace();
+    trace_out.flush();
+    memory.harts.erase(find(memory.harts.begin(), memory.harts.end(), this));
+#ifdef JIT_X86_64
+    if (jit_buffer)
+    {
+        munmap(jit_buffer, JIT_BUFFER_SIZE);
+    }
+#endif
+}
 
-        string bin_data = hex_to_bin(register_data.substr(2)); //convert to binary. 
-        int bit_length = (is_mem[1] == 0) ? 8 : (is_mem[1] == 1) ? 16 : (is_mem[1] == 3) ? 32 : 64;
+// .mc loading. the file is mapped and scanned in place; each line is
+// "ADDRESS VALUE", two hex numbers with an optional 0x, and the value is
+// stored as a word like the sw of a program. blank lines, '#' lines,
+// everything from a ',' or '#' after the value (the Phase1 assembler's
+// comments) and the address alone that ends Phase1's text segment are
+// skipped.
+const size_t MAX_LOAD_ERRORS = 20;
+
+// A program file mapped read-only, or read into memory where there is no mmap
+struct ProgramFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+    bool opened = false;
+#ifdef HAVE_MMAP
+    void *map = nullptr;
 
-        if (bit_length < 64)
+    explicit ProgramFile(const string &file_name)
+    {
+        int fd = open(file_name.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0)
+        {
+            size = st.st_size;
+            map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+            opened = (map != MAP_FAILED);
+            data = opened ? static_cast<const char *>(map) : nullptr;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+    ~ProgramFile()
+    {
+        if (opened && map)
         {
-            bin_data = sign_extend(bin_data, bit_length);
+            munmap(map, size);
         }
+    }
+#else
+    string text;
 
-        register_data = bin_to_hex(bin_data);
+    explicit ProgramFile(const string &file_name)
+    {
+        ifstream in(file_name, ios::binary);
+        opened = static_cast<bool>(in);
+        text.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data = text.data();
+        size = text.size();
+    }
+#endif
+};
 
-        cout << "MEMORY: Load " << ((is_mem[1] == 0) ? "byte" : (is_mem[1] == 1) ? "half-word" : (is_mem[1] == 3) ? "word" : "doubleword")
-                  << nint(register_data, 16) << " from  memory address" << hex << memory_address << dec << endl;
+bool Hart::load_program(const string &file_name, vector<string> &errors)
+{
+    ProgramFile file(file_name);
+    if (!file.opened)
+    {
+        errors.push_back("cannot open input file");
+        return false;
     }
-    else // handle store operation
+    if (file.size >= 4 && memcmp(file.data, "\x7f" "ELF", 4) == 0)
+    {
+        return load_elf(file.data, file.size, errors);
+    }
+    return memory.load_mc(file.data, file.size, errors);
+}
+
+// value of each character as a hex digit, or -1
+static const struct HexDigits
+{
+    int8_t value[256];
+    HexDigits()
     {
-        // ensure proper data formatting
-        string store_data = (register_data.length() > 2) ? register_data.substr(2) : "00";
+        memset(value, -1, sizeof(value));
+        for (int c = 0; c < 10; c++)
+        {
+            value['0' + c] = c;
+        }
+        for (int c = 0; c < 6; c++)
+        {
+            value['a' + c] = value['A' + c] = 10 + c;
+        }
+    }
+} hex_digits;
 
-        // store byte
-        if (is_mem[1] == 0)
+static inline int hex_digit(char c)
+{
+    return hex_digits.value[static_cast<uint8_t>(c)];
+}
+
+// Scans a hex number at p, stopping before end. bit i of upper is set when
+// the i-th digit from the right is spelled in upper-case
+static const char *scan_hex(const char *p, const char *end, uint32_t &value, uint32_t &upper, const char *&error)
+{
+    if (end - p >= 2 && p[0] == '0' && (p[1] | 0x20) == 'x')
+    {
+        p += 2;
+    }
+    const char *digits = p;
+    uint64_t v = 0;
+    upper = 0;
+    int d;
+    while (p < end && (d = hex_digit(*p)) >= 0)
+    {
+        v = (v << 4) | d;
+        upper = (upper << 1) | (*p >= 'A' && *p <= 'F');
+        if (v > 0xffffffffULL)
         {
-            if (store_data.length() < 2)
-                store_data = "00" + store_data;
-            MEM[memory_address] = store_data.substr(store_data.length() - 2, 2);
+            error = "number does not fit in 32 bits";
+            return nullptr;
         }
-        // store half-word
-        else if (is_mem[1] == 1)
+        p++;
+    }
+    if (p == digits)
+    {
+        error = "expected a hex number";
+        return nullptr;
+    }
+    value = static_cast<uint32_t>(v);
+    return p;
+}
+
+bool Memory::load_mc(const char *text, size_t size, vector<string> &errors)
+{
+    size_t bad_lines = 0;
+    int line_number = 0;
+    Page *page = nullptr; // page of the last word stored
+    uint32_t page_number = 0;
+    const char *end = text + size;
+    for (const char *line = text; line < end;)
+    {
+        const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+        eol = eol ? eol : end;
+        const char *next = eol + 1;
+        line_number++;
+
+        auto blank = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+        const char *p = line;
+        while (p < eol && blank(*p))
         {
-            store_data = std::string(4 - store_data.length(), '0') + store_data;
-            MEM[memory_address + 1] = store_data.substr(store_data.length() - 4, 2);
-            MEM[memory_address] = store_data.substr(store_data.length() - 2, 2);
+            p++;
         }
-        // store word
-        else if (is_mem[1] == 3)
+        if (p == eol || *p == '#')
         {
-            store_data = std::string(8 - store_data.length(), '0') + store_data;
-            MEM[memory_address + 3] = store_data.substr(store_data.length() - 8, 2);
-            MEM[memory_address + 2] = store_data.substr(store_data.length() - 6, 2);
-            MEM[memory_address + 1] = store_data.substr(store_data.length() - 4, 2);
-            MEM[memory_address] = store_data.substr(store_data.length() - 2, 2);
+            line = next;
+            continue;
         }
-        // store double-word
-        else if (is_mem[1] == 4)
+
+        uint32_t address = 0, value = 0, upper_digits = 0;
+        const char *error = nullptr;
+        p = scan_hex(p, eol, address, upper_digits, error);
+        if (p && p < eol && !blank(*p))
         {
-            store_data = std::string(16 - store_data.length(), '0') + store_data;
-            for (int i = 0; i < 8; i++)
+            error = "expected a space after the address";
+            p = nullptr;
+        }
+        while (p && p < eol && blank(*p))
+        {
+            p++;
+        }
+        if (p == eol)
+        {
+            // an address alone ends the Phase1 text segment; the word there reads 0, the exit instruction
+            line = next;
+            continue;
+        }
+        p = p ? scan_hex(p, eol, value, upper_digits, error) : nullptr;
+        while (p && p < eol && blank(*p))
+        {
+            p++;
+        }
+        if (p && p < eol && *p != ',' && *p != '#')
+        {
+            error = "unexpected text after the value";
+            p = nullptr;
+        }
+        if (!p)
+        {
+            if (bad_lines++ < MAX_LOAD_ERRORS)
+            {
+                errors.push_back("line " + to_string(line_number) + ": " + error);
+            }
+            line = next;
+            continue;
+        }
+
+        line = next;
+
+        // remember bytes spelled in upper-case so memory.mc echoes them unchanged.
+        // byte b is spelled by digits 2 * b and 2 * b + 1 from the right
+        uint64_t upper_bytes = 0;
+        for (int b = 0; b < 4; b++)
+        {
+            upper_bytes |= static_cast<uint64_t>(((upper_digits >> (2 * b)) & 3) != 0) << b;
+        }
+
+        // an aligned word goes straight into the page of the previous one when
+        // nothing else (dirty tracking, decoded instructions, other harts) needs to see the store
+        uint32_t off = address & PAGE_MASK;
+        if (!shared && !track_dirty && (off & 3) == 0)
+        {
+            if (!page || page_number != address >> PAGE_SHIFT)
+            {
+                page = get_page(address);
+                page_number = address >> PAGE_SHIFT;
+            }
+            if (!page->decoded)
             {
-                MEM[memory_address + 7 - i] = store_data.substr(i * 2, 2);
+                memcpy(page->data + off, &value, 4);
+                page->present[off >> 6] |= 0xfULL << (off & 63);
+                page->upper[off >> 6] = (page->upper[off >> 6] & ~(0xfULL << (off & 63))) | (upper_bytes << (off & 63));
+                continue;
             }
         }
 
-        cout << "MEMORY: Store" << ((is_mem[1] == 0) ? "byte" : (is_mem[1] == 1) ? "half-word" : (is_mem[1] == 3) ? "word" : "doubleword")
-                  << nint(register_data, 16) << " to memory address" << hex << memory_address << dec << std::endl;
+        write_mem_word(address, value);
+        for (int b = 0; b < 4; b++)
+        {
+            if ((upper_bytes >> b) & 1)
+            {
+                uint32_t byte_off = (address + b) & PAGE_MASK;
+                get_page(address + b)->upper[byte_off >> 6] |= 1ULL << (byte_off & 63);
+            }
+        }
     }
 
-    // update pc according to control signals
-    if (pc_select)
+    if (bad_lines > MAX_LOAD_ERRORS)
     {
-        PC = return_address;
+        errors.push_back("... and " + to_string(bad_lines - MAX_LOAD_ERRORS) + " more malformed lines");
     }
-    else if (inc_select)
+    return bad_lines == 0;
+}
+
+void Memory::write_block(uint32_t address, const uint8_t *data, uint32_t size)
+{
+    while (size > 0)
     {
-        PC += pc_offset;
+        uint32_t off = address & PAGE_MASK;
+        uint32_t count = min(size, PAGE_SIZE - off);
+        Page *page = get_page(address);
+        if (data)
+        {
+            memcpy(page->data + off, data, count);
+            data += count;
+        }
+        else
+        {
+            memset(page->data + off, 0, count);
+        }
+
+        if (shared || track_dirty || page->decoded)
+        {
+            mark_present(address, count, true);
+        }
+        else
+        {
+            // present and not upper-case, 64 bytes per bitmap word
+            for (uint32_t i = off; i < off + count;)
+            {
+                uint32_t bits = min(64 - (i & 63), off + count - i);
+                uint64_t mask = ((bits == 64) ? ~0ULL : ((1ULL << bits) - 1)) << (i & 63);
+                page->present[i >> 6] |= mask;
+                page->upper[i >> 6] &= ~mask;
+                i += bits;
+            }
+        }
+        address += count;
+        size -= count;
     }
-    else
+}
+
+void Memory::copy_pages(const Memory &image)
+{
+    for (int t = 0; t < 1024; t++)
     {
-        PC += 4;
+        for (int p = 0; image.page_table[t] && p < 1024; p++)
+        {
+            const Page *from = image.page_table[t][p];
+            if (!from)
+            {
+                continue;
+            }
+            Page *page = get_page((t << 22) | (p << PAGE_SHIFT));
+            memcpy(page->data, from->data, sizeof(page->data));
+            memcpy(page->present, from->present, sizeof(page->present));
+            memcpy(page->upper, from->upper, sizeof(page->upper));
+        }
     }
 }
 
-// Writes the results back to the register file
-void write_back()
+// ELF loading. a statically linked RV32 executable has its PT_LOAD segments
+// copied into memory (the rest of a segment past its file bytes, .bss, is
+// zeroed), PC set to e_entry, x2 to a 16-byte aligned stack top, and x3 to
+// __global_pointer$ when the symbol table has it. executable sections are
+// decoded word by word first, so a program using an instruction outside the
+// supported set is rejected before it runs. a zero word still ends the run.
+const uint32_t ELF_STACK_TOP = 0x7FFFFFF0;
+
+struct ElfHeader
 {
-    if (write_back_signal)
+    uint8_t ident[16];
+    uint16_t type, machine;
+    uint32_t version, entry, phoff, shoff, flags;
+    uint16_t ehsize, phentsize, phnum, shentsize, shnum, shstrndx;
+};
+
+struct ElfProgramHeader
+{
+    uint32_t type, offset, vaddr, paddr, filesz, memsz, flags, align;
+};
+
+struct ElfSectionHeader
+{
+    uint32_t name, type, flags, addr, offset, size, link, info, addralign, entsize;
+};
+
+struct ElfSymbol
+{
+    uint32_t name, value, size;
+    uint8_t info, other;
+    uint16_t shndx;
+};
+
+const uint16_t ELF_EXEC = 2, ELF_RISCV = 243;
+const uint32_t ELF_PT_LOAD = 1, ELF_PT_DYNAMIC = 2, ELF_PT_INTERP = 3, ELF_PF_X = 1;
+const uint32_t ELF_SHT_SYMTAB = 2, ELF_SHT_NOBITS = 8, ELF_SHF_EXECINSTR = 4;
+const uint32_t ELF_RISCV_RVC = 1;
+
+bool Hart::load_elf(const char *image, size_t size, vector<string> &errors)
+{
+    ElfHeader header;
+    if (size < sizeof(header))
+    {
+        errors.push_back("truncated ELF header");
+        return false;
+    }
+    memcpy(&header, image, sizeof(header));
+    if (header.ident[4] != 1 || header.ident[5] != 1)
+    {
+        errors.push_back("not a 32-bit little-endian ELF file");
+        return false;
+    }
+    if (header.machine != ELF_RISCV)
+    {
+        errors.push_back("not a RISC-V executable");
+        return false;
+    }
+    if (header.type != ELF_EXEC)
+    {
+        errors.push_back("not a statically linked executable");
+        return false;
+    }
+    if (header.flags & ELF_RISCV_RVC)
+    {
+        errors.push_back("built for compressed instructions (RVC), which are not supported");
+        return false;
+    }
+    if (header.entry & 3)
     {
-        if (stoi(rd, nullptr, 2) != 0)
+        errors.push_back("entry point " + nhex(header.entry) + " is not word aligned");
+        return false;
+    }
+
+    // a table is valid if it lies inside the file
+    auto table_fits = [&](uint32_t offset, uint32_t count, uint32_t entry_size, size_t expected) {
+        return count == 0 || (entry_size == expected && offset <= size && (size - offset) / entry_size >= count);
+    };
+    if (!table_fits(header.phoff, header.phnum, header.phentsize, sizeof(ElfProgramHeader)) ||
+        !table_fits(header.shoff, header.shnum, header.shentsize, sizeof(ElfSectionHeader)))
+    {
+        errors.push_back("truncated program or section header table");
+        return false;
+    }
+
+    vector<ElfProgramHeader> segments(header.phnum);
+    memcpy(segments.data(), image + header.phoff, header.phnum * sizeof(ElfProgramHeader));
+    vector<ElfSectionHeader> sections(header.shnum);
+    memcpy(sections.data(), image + header.shoff, header.shnum * sizeof(ElfSectionHeader));
+
+    for (const ElfProgramHeader &ph : segments)
+    {
+        if (ph.type == ELF_PT_INTERP || ph.type == ELF_PT_DYNAMIC)
         {
-            X[stoi(rd, nullptr, 2)] = register_data;
-            cout << "WRITEBACK: Register X" << stoi(rd, nullptr, 2) << " updated with value 0x" << register_data << endl;
+            errors.push_back("dynamically linked executables are not supported");
+            return false;
         }
-        else
+        if (ph.type != ELF_PT_LOAD)
         {
-            cout << "WRITEBACK: no change: zero register is read-only" << endl;
+            continue;
+        }
+        if (ph.filesz > ph.memsz || ph.offset > size || size - ph.offset < ph.filesz ||
+            static_cast<uint64_t>(ph.vaddr) + ph.memsz > 0x100000000ULL)
+        {
+            errors.push_back("segment at " + nhex(ph.vaddr) + " does not fit in the file or in memory");
+            return false;
         }
     }
-    else
+
+    // the code to check, as {address, file offset, size}: executable sections, or
+    // executable segments when there is no section table. it is read from the
+    // file so a rejected image leaves memory untouched
+    struct CodeRange
     {
-        cout << "WRITEBACK: Write-back stage bypassed (no destination register)" << endl;
+        uint32_t addr, offset, size;
+    };
+    vector<CodeRange> code;
+    for (const ElfSectionHeader &sh : sections)
+    {
+        if ((sh.flags & ELF_SHF_EXECINSTR) && sh.type != ELF_SHT_NOBITS)
+        {
+            if (sh.offset > size || size - sh.offset < sh.size)
+            {
+                errors.push_back("code section at " + nhex(sh.addr) + " does not fit in the file");
+                return false;
+            }
+            code.push_back({sh.addr, sh.offset, sh.size});
+        }
+    }
+    if (sections.empty())
+    {
+        for (const ElfProgramHeader &ph : segments)
+        {
+            if (ph.type == ELF_PT_LOAD && (ph.flags & ELF_PF_X))
+            {
+                code.push_back({ph.vaddr, ph.offset, ph.filesz});
+            }
+        }
+    }
+    size_t unsupported = 0;
+    for (const CodeRange &range : code)
+    {
+        for (uint64_t a = (range.addr + 3) & ~3u; a + 4 <= static_cast<uint64_t>(range.addr) + range.size; a += 4)
+        {
+            uint32_t word;
+            memcpy(&word, image + range.offset + (a - range.addr), sizeof(word));
+            DecodedInstruction d;
+            if (word != 0 && !decode_instruction(word, d) && unsupported++ < MAX_LOAD_ERRORS)
+            {
+                errors.push_back(nhex(a) + ": unsupported instruction " + nhex(word));
+            }
+        }
+    }
+    if (unsupported > MAX_LOAD_ERRORS)
+    {
+        errors.push_back("... and " + to_string(unsupported - MAX_LOAD_ERRORS) + " more unsupported instructions");
+    }
+    if (unsupported)
+    {
+        return false;
     }
-}
 
-// Memory write
-void write_word(const std::string &address, const std::string &instruction)
-{
-    int idx = std::stoi(address.substr(2), nullptr, 16);
-    MEM[idx] = instruction.substr(8, 2);
-    MEM[idx + 1] = instruction.substr(6, 2);
-    MEM[idx + 2] = instruction.substr(4, 2);
-    MEM[idx + 3] = instruction.substr(2, 2);
+    for (const ElfProgramHeader &ph : segments)
+    {
+        if (ph.type == ELF_PT_LOAD)
+        {
+            memory.write_block(ph.vaddr, reinterpret_cast<const uint8_t *>(image + ph.offset), ph.filesz);
+            memory.write_block(ph.vaddr + ph.filesz, nullptr, ph.memsz - ph.filesz);
+        }
+    }
+    PC = header.entry;
+    X[2] = ELF_STACK_TOP;
+    for (const ElfSectionHeader &sh : sections)
+    {
+        if (sh.type != ELF_SHT_SYMTAB || sh.link >= sections.size() || sh.offset > size ||
+            size - sh.offset < sh.size || sections[sh.link].offset > size || size - sections[sh.link].offset < sections[sh.link].size)
+        {
+            continue;
+        }
+        const char *names = image + sections[sh.link].offset;
+        uint32_t names_size = sections[sh.link].size;
+        for (uint32_t i = 0; i + sizeof(ElfSymbol) <= sh.size; i += sizeof(ElfSymbol))
+        {
+            ElfSymbol symbol;
+            memcpy(&symbol, image + sh.offset + i, sizeof(symbol));
+            // the name must end inside the string table, NUL included
+            static const char GLOBAL_POINTER[] = "__global_pointer$";
+            if (symbol.name < names_size && names_size - symbol.name >= sizeof(GLOBAL_POINTER) &&
+                memcmp(names + symbol.name, GLOBAL_POINTER, sizeof(GLOBAL_POINTER)) == 0)
+            {
+                X[3] = symbol.value;
+            }
+        }
+    }
+    return true;
 }
 
 // Exit the simulation and write results to files
-void swi_exit()
+void Hart::swi_exit()
 {
+    TRACE_AT(TRACE_SUMMARY) << "Total clock cycles: " << clock_cycles << '\n';
+    trace_out.flush();
     write_data_memory();
     terminate1 = true;
 }
@@ -0,0 +1,172 @@
+/* pipeline.cpp
+   Five-stage pipeline timing model (--pipeline). run_RISCVsim() executes each
+   instruction and issues it here in program order; the model clocks the
+   IF/ID, ID/EX, EX/MEM and MEM/WB registers until the instruction has been
+   fetched, so each register holds a different instruction in a cycle. ID
+   holds an instruction while a register it reads is not ready, and a taken
+   branch or jump squashes the two wrong-path fetches behind it when it
+   resolves in EX. With --icache or --dcache a miss holds the instruction in
+   IF, or the whole pipeline behind MEM, for the cycles the caches charged it.
+*/
+
+#include "../include/myARMSim.h"
+
+PipelineModel::PipelineModel(int forwarding, BranchUnit *branches) : forwarding(forwarding), branches(branches)
+{
+}
+
+// Returns the cause ID has to hold consumer for this cycle, or -1 if it can go on to EX.
+// the register file is written in the first half of a cycle and read in the second,
+// so an instruction in WB never holds anyone up.
+int PipelineModel::hazard(const PipelineSlot &consumer) const
+{
+    if (!consumer.valid)
+    {
+        return -1;
+    }
+    int cause = -1;
+    for (uint8_t source : {consumer.rs1, consumer.rs2})
+    {
+        if (source == 0)
+        {
+            continue;
+        }
+        if (id_ex.valid && id_ex.rd == source)
+        {
+            // the producer is in EX: its ALU result reaches EX next cycle over EX-EX,
+            // a load's data not before the cycle after
+            if (id_ex.load)
+            {
+                return STALL_LOAD_USE;
+            }
+            if (!(forwarding & FORWARD_EX_EX))
+            {
+                cause = STALL_DATA;
+            }
+        }
+        else if (ex_mem.valid && ex_mem.rd == source && !(forwarding & FORWARD_MEM_EX))
+        {
+            // the producer is in MEM: MEM-EX forwards its result, otherwise wait for WB
+            cause = STALL_DATA;
+        }
+    }
+    return cause;
+}
+
+// One clock cycle. returns true if next was fetched in it
+bool PipelineModel::clock(const PipelineSlot *next)
+{
+    cycles++;
+    if (mem_wb.valid)
+    {
+        instructions++;
+    }
+
+    // a D-cache miss holds MEM and everything behind it
+    if (ex_mem.valid && ex_mem.memory_stall > 0)
+    {
+        ex_mem.memory_stall--;
+        stalls[STALL_DCACHE]++;
+        mem_wb = PipelineSlot();
+        return false;
+    }
+
+    // a redirect resolving in EX squashes what is in ID and what IF fetches now
+    bool squash = id_ex.valid && id_ex.redirect;
+    int cause = squash ? -1 : hazard(if_id);
+
+    mem_wb = ex_mem;
+    ex_mem = id_ex;
+    if (squash)
+    {
+        flushes++;
+        squashed += 2;
+        id_ex = PipelineSlot();
+        if_id = PipelineSlot();
+        wrong_path = false;
+        return false;
+    }
+    if (cause >= 0)
+    {
+        // ID and IF hold, EX gets a bubble
+        stalls[cause]++;
+        id_ex = PipelineSlot();
+        return false;
+    }
+    id_ex = if_id;
+    if (wrong_path || !next)
+    {
+        if_id = PipelineSlot();
+        return false;
+    }
+    if (fetch_wait < next->fetch_stall)
+    {
+        // IF waits for the I-cache miss
+        fetch_wait++;
+        stalls[STALL_ICACHE]++;
+        if_id = PipelineSlot();
+        return false;
+    }
+    fetch_wait = 0;
+    if_id = *next;
+    wrong_path = next->redirect;
+    return true;
+}
+
+bool parse_forwarding(const string &paths, int &forwarding)
+{
+    stringstream list(paths);
+    string path;
+    forwarding = (paths == "on") ? FORWARD_EX_EX | FORWARD_MEM_EX : 0;
+    while (paths != "on" && paths != "off" && getline(list, path, ','))
+    {
+        if (path != "ex-ex" && path != "mem-ex")
+        {
+            return false;
+        }
+        forwarding |= (path == "ex-ex") ? FORWARD_EX_EX : FORWARD_MEM_EX;
+    }
+    return true;
+}
+
+void PipelineModel::issue(PipelineSlot slot)
+{
+    // without a branch unit fetch always falls through, so every taken branch and jump redirects
+    slot.redirect = branches ? branches->fetch(slot) : (slot.next_pc != slot.pc + 4);
+    while (!clock(&slot))
+    {
+    }
+}
+
+void PipelineModel::drain()
+{
+    while (if_id.valid || id_ex.valid || ex_mem.valid || mem_wb.valid)
+    {
+        clock(nullptr);
+    }
+}
+
+void PipelineModel::report(ostream &out)
+{
+    drain();
+
+    const char *paths = (forwarding == (FORWARD_EX_EX | FORWARD_MEM_EX)) ? "EX-EX and MEM-EX forwarding" :
+                        (forwarding == FORWARD_EX_EX) ? "EX-EX forwarding only" :
+                        (forwarding == FORWARD_MEM_EX) ? "MEM-EX forwarding only" : "no forwarding";
+    char line[256];
+    snprintf(line, sizeof(line), "Pipeline: 5 stages, %s, branches and jumps resolved in EX\n", paths);
+    out << line;
+    snprintf(line, sizeof(line), "Cycles: %lld  Instructions: %lld  CPI: %.2f\n", cycles, instructions,
+             instructions ? static_cast<double>(cycles) / instructions : 0.0);
+    out << line;
+    snprintf(line, sizeof(line), "Stall cycles: %lld load-use, %lld data (no forwarding path), %lld I-cache, %lld D-cache\n",
+             stalls[STALL_LOAD_USE], stalls[STALL_DATA], stalls[STALL_ICACHE], stalls[STALL_DCACHE]);
+    out << line;
+    snprintf(line, sizeof(line), "Flushes: %lld, %lld wrong-path fetches squashed\n", flushes, squashed);
+    out << line;
+    if (branches)
+    {
+        branches->report(out);
+    }
+    out.flush();
+}
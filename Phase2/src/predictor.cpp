@@ -0,0 +1,319 @@
+/* predictor.cpp
+   Branch prediction for the pipeline model (--predictor, --btb, --ras): the
+   direction predictors, a set-associative branch target buffer with LRU
+   replacement and a return-address stack, with per-branch statistics.
+*/
+
+#include "../include/myARMSim.h"
+
+// index of pc in a table of 2^bits entries; instructions are word aligned
+static inline uint32_t table_index(uint32_t pc, int bits)
+{
+    return (pc >> 2) & ((1u << bits) - 1);
+}
+
+// saturating 2-bit counter: 0-1 predict not taken, 2-3 taken
+static inline void train(uint8_t &counter, bool taken)
+{
+    if (taken && counter < 3)
+    {
+        counter++;
+    }
+    else if (!taken && counter > 0)
+    {
+        counter--;
+    }
+}
+
+class NotTakenPredictor : public BranchPredictor
+{
+public:
+    bool predict(uint32_t, uint32_t) override { return false; }
+    void update(uint32_t, uint32_t, bool) override {}
+};
+
+// backward taken, forward not taken: loops close with backward branches
+class BtfnPredictor : public BranchPredictor
+{
+public:
+    bool predict(uint32_t pc, uint32_t target) override { return target < pc; }
+    void update(uint32_t, uint32_t, bool) override {}
+};
+
+// last outcome of each branch
+class OneBitPredictor : public BranchPredictor
+{
+public:
+    explicit OneBitPredictor(int bits) : bits(bits), last(1u << bits, 0) {}
+    bool predict(uint32_t pc, uint32_t) override { return last[table_index(pc, bits)]; }
+    void update(uint32_t pc, uint32_t, bool taken) override { last[table_index(pc, bits)] = taken; }
+
+private:
+    int bits;
+    vector<uint8_t> last;
+};
+
+// bimodal: a 2-bit counter per branch, starting weakly not taken
+class TwoBitPredictor : public BranchPredictor
+{
+public:
+    explicit TwoBitPredictor(int bits) : bits(bits), counters(1u << bits, 1) {}
+    bool predict(uint32_t pc, uint32_t) override { return counters[table_index(pc, bits)] >= 2; }
+    void update(uint32_t pc, uint32_t, bool taken) override { train(counters[table_index(pc, bits)], taken); }
+
+private:
+    int bits;
+    vector<uint8_t> counters;
+};
+
+// 2-bit counters indexed by the pc xor the global history of the last `bits` branches
+class GsharePredictor : public BranchPredictor
+{
+public:
+    explicit GsharePredictor(int bits) : bits(bits), counters(1u << bits, 1) {}
+    bool predict(uint32_t pc, uint32_t) override { return counters[index(pc)] >= 2; }
+    void update(uint32_t pc, uint32_t, bool taken) override
+    {
+        train(counters[index(pc)], taken);
+        history = ((history << 1) | taken) & ((1u << bits) - 1);
+    }
+
+private:
+    uint32_t index(uint32_t pc) const { return table_index(pc, bits) ^ history; }
+
+    int bits;
+    vector<uint8_t> counters;
+    uint32_t history = 0;
+};
+
+// bimodal and gshare, with a 2-bit chooser per branch that learns which of them to trust
+class TournamentPredictor : public BranchPredictor
+{
+public:
+    explicit TournamentPredictor(int bits) : bits(bits), local(bits), global(bits), chooser(1u << bits, 1) {}
+    bool predict(uint32_t pc, uint32_t target) override
+    {
+        return (chooser[table_index(pc, bits)] >= 2) ? global.predict(pc, target) : local.predict(pc, target);
+    }
+    void update(uint32_t pc, uint32_t target, bool taken) override
+    {
+        bool local_right = local.predict(pc, target) == taken;
+        bool global_right = global.predict(pc, target) == taken;
+        if (local_right != global_right)
+        {
+            train(chooser[table_index(pc, bits)], global_right);
+        }
+        local.update(pc, target, taken);
+        global.update(pc, target, taken);
+    }
+
+private:
+    int bits;
+    TwoBitPredictor local;
+    GsharePredictor global;
+    vector<uint8_t> chooser;
+};
+
+unique_ptr<BranchPredictor> make_predictor(PredictorKind kind, int table_bits)
+{
+    switch (kind)
+    {
+    case PREDICT_BTFN:
+        return unique_ptr<BranchPredictor>(new BtfnPredictor());
+    case PREDICT_ONE_BIT:
+        return unique_ptr<BranchPredictor>(new OneBitPredictor(table_bits));
+    case PREDICT_TWO_BIT:
+        return unique_ptr<BranchPredictor>(new TwoBitPredictor(table_bits));
+    case PREDICT_GSHARE:
+        return unique_ptr<BranchPredictor>(new GsharePredictor(table_bits));
+    case PREDICT_TOURNAMENT:
+        return unique_ptr<BranchPredictor>(new TournamentPredictor(table_bits));
+    default:
+        return unique_ptr<BranchPredictor>(new NotTakenPredictor());
+    }
+}
+
+static const char *const predictor_names[] = {"not-taken", "btfn", "1bit", "2bit", "gshare", "tournament"};
+
+bool parse_predictor(const string &name, PredictorKind &kind)
+{
+    for (int k = PREDICT_NOT_TAKEN; k <= PREDICT_TOURNAMENT; k++)
+    {
+        if (name == predictor_names[k])
+        {
+            kind = static_cast<PredictorKind>(k);
+            return true;
+        }
+    }
+    return false;
+}
+
+BranchUnit::BranchUnit(PredictorKind kind, int table_bits, int btb_entries, int btb_ways, int ras_entries)
+    : kind(kind), table_bits(table_bits), predictor(make_predictor(kind, table_bits)),
+      btb_sets(btb_entries ? max(1, btb_entries / btb_ways) : 0), btb_ways(btb_ways),
+      btb(static_cast<size_t>(btb_sets) * btb_ways), ras(ras_entries)
+{
+}
+
+bool BranchUnit::btb_lookup(uint32_t pc, uint32_t &target)
+{
+    if (!btb_sets)
+    {
+        return false;
+    }
+    btb_lookups++;
+    BtbEntry *set = &btb[((pc >> 2) % btb_sets) * btb_ways];
+    for (int w = 0; w < btb_ways; w++)
+    {
+        if (set[w].valid && set[w].pc == pc)
+        {
+            btb_hits++;
+            set[w].last_use = ++tick;
+            target = set[w].target;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BranchUnit::btb_update(uint32_t pc, uint32_t target)
+{
+    if (!btb_sets)
+    {
+        return;
+    }
+    BtbEntry *set = &btb[((pc >> 2) % btb_sets) * btb_ways];
+    BtbEntry *victim = &set[0];
+    for (int w = 0; w < btb_ways; w++)
+    {
+        if (set[w].valid && set[w].pc == pc)
+        {
+            victim = &set[w];
+            break;
+        }
+        if (!set[w].valid || set[w].last_use < victim->last_use)
+        {
+            victim = &set[w];
+        }
+    }
+    victim->valid = true;
+    victim->pc = pc;
+    victim->target = target;
+    victim->last_use = ++tick;
+}
+
+bool BranchUnit::fetch(const PipelineSlot &slot)
+{
+    if (slot.control == CONTROL_NONE)
+    {
+        return slot.next_pc != slot.pc + 4;
+    }
+
+    bool taken = (slot.next_pc != slot.pc + 4);
+    uint32_t predicted = slot.pc + 4;
+    uint32_t target;
+    bool hit = btb_lookup(slot.pc, target);
+
+    // calls write the return address to x1 or x5; returns jump through one of them to x0
+    bool call = (slot.control != CONTROL_BRANCH) && (slot.rd == 1 || slot.rd == 5);
+    bool is_return = (slot.control == CONTROL_JALR) && slot.rd == 0 && (slot.rs1 == 1 || slot.rs1 == 5);
+
+    if (slot.control == CONTROL_BRANCH)
+    {
+        bool direction = predictor->predict(slot.pc, slot.target);
+        if (direction && hit)
+        {
+            predicted = target;
+        }
+        predictor->update(slot.pc, slot.target, taken);
+        branches++;
+        branch_mispredictions += (direction != taken);
+    }
+    else if (is_return && !ras.empty() && ras_top > 0)
+    {
+        predicted = ras[--ras_top % ras.size()];
+        returns++;
+        ras_correct += (predicted == slot.next_pc);
+    }
+    else if (hit)
+    {
+        predicted = target;
+    }
+    if (call && !ras.empty())
+    {
+        ras[ras_top++ % ras.size()] = slot.pc + 4;
+    }
+    if (taken)
+    {
+        btb_update(slot.pc, slot.next_pc);
+    }
+
+    bool mispredicted = (predicted != slot.next_pc);
+    if (slot.control != CONTROL_BRANCH)
+    {
+        jumps++;
+        jump_mispredictions += mispredicted;
+    }
+    BranchSite &site = sites[slot.pc];
+    site.control = slot.control;
+    site.executed++;
+    site.taken += taken;
+    site.mispredicted += mispredicted;
+    return mispredicted;
+}
+
+// Prints the configuration, overall accuracy and the branches mispredicted most
+void BranchUnit::report(ostream &out)
+{
+    char line[256];
+    string btb_text = btb_sets ? to_string(btb_sets * btb_ways) + "-entry " + to_string(btb_ways) + "-way BTB" : "no BTB";
+    string ras_text = ras.empty() ? "no return-address stack" : to_string(ras.size()) + "-entry return-address stack";
+    snprintf(line, sizeof(line), "Branch prediction: %s", predictor_names[kind]);
+    out << line;
+    if (kind >= PREDICT_ONE_BIT)
+    {
+        out << " (" << (1 << table_bits) << " entries)";
+    }
+    out << ", " << btb_text << ", " << ras_text << '\n';
+
+    auto percent = [](long long part, long long whole) { return whole ? 100.0 * part / whole : 0.0; };
+    snprintf(line, sizeof(line), "Conditional branches: %lld, direction mispredicted %lld, accuracy %.2f%%\n",
+             branches, branch_mispredictions, percent(branches - branch_mispredictions, branches));
+    out << line;
+    snprintf(line, sizeof(line), "Jumps: %lld, target mispredicted %lld, accuracy %.2f%%\n",
+             jumps, jump_mispredictions, percent(jumps - jump_mispredictions, jumps));
+    out << line;
+    if (btb_sets)
+    {
+        snprintf(line, sizeof(line), "BTB: %lld lookups, %lld hits (%.2f%%)\n", btb_lookups, btb_hits, percent(btb_hits, btb_lookups));
+        out << line;
+    }
+    if (!ras.empty())
+    {
+        snprintf(line, sizeof(line), "Return-address stack: %lld returns, %lld predicted correctly\n", returns, ras_correct);
+        out << line;
+    }
+
+    // branches and jumps by mispredictions, then address
+    vector<pair<uint32_t, BranchSite>> ranked(sites.begin(), sites.end());
+    sort(ranked.begin(), ranked.end(), [](const pair<uint32_t, BranchSite> &a, const pair<uint32_t, BranchSite> &b) {
+        return a.second.mispredicted != b.second.mispredicted ? a.second.mispredicted > b.second.mispredicted : a.first < b.first;
+    });
+    if (!ranked.empty())
+    {
+        out << "Per-branch accuracy (most mispredicted first):" << '\n';
+    }
+    static const char *const kinds[] = {"", "branch", "jal", "jalr"};
+    for (size_t i = 0; i < ranked.size() && i < 20; i++)
+    {
+        const BranchSite &s = ranked[i].second;
+        snprintf(line, sizeof(line), "  %s %-6s executed %lld  taken %lld  mispredicted %lld  accuracy %.2f%%\n",
+                 nhex(ranked[i].first).c_str(), kinds[s.control], s.executed, s.taken, s.mispredicted,
+                 percent(s.executed - s.mispredicted, s.executed));
+        out << line;
+    }
+    if (ranked.size() > 20)
+    {
+        out << "  ... and " << ranked.size() - 20 << " more" << '\n';
+    }
+}
@@ -0,0 +1,564 @@
+/* serve.cpp
+   myRISCVSim --serve: a long-lived simulator driven by one JSON object per
+   line on stdin (or a Unix socket with --socket PATH), so that a frontend
+   such as gui.py can load, step, run and inspect a program without starting
+   or compiling anything per action. Requests:
+
+     {"cmd":"load","file":"prog.mc"}          load a program, PC = 0
+     {"cmd":"reset"}                           load the last program again
+     {"cmd":"step","count":N}                  run N instructions (default 1)
+     {"cmd":"run","until":A,"max":N}           run to the end, until PC is A
+                                               or for at most N instructions
+     {"cmd":"registers"}                       PC, cycle count and x0..x31
+     {"cmd":"memory","address":A,"length":L}   L bytes from A, as hex
+     {"cmd":"trace","level":L,"stages":S}      as --trace and --trace-stages
+     {"cmd":"quit"}
+
+   Every reply is one line: {"ok":true,...} or {"ok":false,"error":"..."}.
+   Numbers are JSON numbers or strings such as "0x1000". step and run reply
+   with the state (paused, finished or error), PC, cycle count and the trace
+   the instructions printed; run uses the fast engine when the trace is off.
+   They also carry what changed since the previous step, run, load or reset:
+
+     "delta":{"registers":[[5,1],[6,1000]],
+              "memory":[{"address":268435456,"length":8,"bytes":"0100000002000000"}]}
+
+   memory lists the runs of words stored to, from the per-page dirty bits of
+   Memory, so a delta costs only what was written. "bytes" is left out when
+   the ranges add up to more than MAX_MEMORY_READ bytes; read them instead.
+*/
+
+#include "../include/myARMSim.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define HAVE_UNIX_SOCKETS 1
+#endif
+
+const long long MAX_MEMORY_READ = 1 << 20;
+
+// A request: one flat JSON object whose values are strings, numbers, booleans or null
+struct Request
+{
+    map<string, string> fields;
+
+    bool has(const string &key) const { return fields.count(key) != 0; }
+
+    string text(const string &key) const
+    {
+        auto it = fields.find(key);
+        return it == fields.end() ? "" : it->second;
+    }
+
+    // a JSON number, or a string in any base stoll accepts
+    bool number(const string &key, long long &value) const
+    {
+        string s = text(key);
+        size_t used = 0;
+        try
+        {
+            value = stoll(s, &used, 0);
+        }
+        catch (const exception &)
+        {
+            return false;
+        }
+        return used == s.size();
+    }
+};
+
+static void skip_space(const string &s, size_t &i)
+{
+    while (i < s.size() && isspace(static_cast<unsigned char>(s[i])))
+    {
+        i++;
+    }
+}
+
+// Reads the JSON string starting at s[i] (the opening quote) into out
+static bool parse_string(const string &s, size_t &i, string &out)
+{
+    out.clear();
+    for (i++; i < s.size(); i++)
+    {
+        char c = s[i];
+        if (c == '"')
+        {
+            i++;
+            return true;
+        }
+        if (c != '\\')
+        {
+            out += c;
+            continue;
+        }
+        if (++i == s.size())
+        {
+            return false;
+        }
+        switch (s[i])
+        {
+        case 'n': out += '\n'; break;
+        case 't': out += '\t'; break;
+        case 'r': out += '\r'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'u':
+        {
+            // only code points below 0x80 can appear in file names we can open here
+            if (i + 4 >= s.size() ||
+                s.find_first_not_of("0123456789abcdefABCDEF", i + 1) < i + 5)
+            {
+                return false;
+            }
+            out += static_cast<char>(stoi(s.substr(i + 1, 4), nullptr, 16) & 0x7f);
+            i += 4;
+            break;
+        }
+        default: out += s[i]; break; // \" \\ \/
+        }
+    }
+    return false;
+}
+
+static bool parse_request(const string &line, Request &request, string &error)
+{
+    size_t i = 0;
+    skip_space(line, i);
+    if (i == line.size() || line[i] != '{')
+    {
+        error = "a request is a JSON object";
+        return false;
+    }
+    i++;
+    skip_space(line, i);
+    if (i < line.size() && line[i] == '}')
+    {
+        return true;
+    }
+    while (true)
+    {
+        string key, value;
+        skip_space(line, i);
+        if (i == line.size() || line[i] != '"' || !parse_string(line, i, key))
+        {
+            error = "expected a string key";
+            return false;
+        }
+        skip_space(line, i);
+        if (i == line.size() || line[i] != ':')
+        {
+            error = "expected ':' after \"" + key + "\"";
+            return false;
+        }
+        i++;
+        skip_space(line, i);
+        if (i < line.size() && line[i] == '"')
+        {
+            if (!parse_string(line, i, value))
+            {
+                error = "unterminated string or bad escape";
+                return false;
+            }
+        }
+        else
+        {
+            // number, true, false or null: taken as the text up to the next separator
+            size_t end = line.find_first_of(",} \t\r\n", i);
+            value = line.substr(i, end == string::npos ? string::npos : end - i);
+            if (value.empty() || value[0] == '{' || value[0] == '[')
+            {
+                error = "the value of \"" + key + "\" must be a string, number or boolean";
+                return false;
+            }
+            i = (end == string::npos) ? line.size() : end;
+        }
+        request.fields[key] = value;
+        skip_space(line, i);
+        if (i < line.size() && line[i] == ',')
+        {
+            i++;
+            continue;
+        }
+        if (i < line.size() && line[i] == '}')
+        {
+            return true;
+        }
+        error = "expected ',' or '}'";
+        return false;
+    }
+}
+
+static string json_string(const string &s)
+{
+    string out = "\"";
+    for (unsigned char c : s)
+    {
+        switch (c)
+        {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        case '\r': out += "\\r"; break;
+        default:
+            if (c < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+            {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    return out + "\"";
+}
+
+static string error_reply(const string &message)
+{
+    return "{\"ok\":false,\"error\":" + json_string(message) + "}";
+}
+
+// length bytes of memory from address as hex; reading does not allocate pages or mark bytes present
+static string hex_bytes(Memory &memory, uint32_t address, long long length)
+{
+    static const char digits[] = "0123456789abcdef";
+    string bytes(2 * length, '0');
+    for (long long k = 0; k < length; k++)
+    {
+        uint8_t byte = memory.read_mem_byte(static_cast<uint32_t>(address + k));
+        bytes[2 * k] = digits[byte >> 4];
+        bytes[2 * k + 1] = digits[byte & 0xf];
+    }
+    return bytes;
+}
+
+// The simulator behind --serve: one Memory and Hart, replaced on every load and reset
+class Server
+{
+public:
+    Server(int trace_level, int trace_stages) : trace_level(trace_level), trace_stages(trace_stages)
+    {
+        string error;
+        start("", error);
+    }
+
+    // answers one request line; sets done on quit
+    string handle(const string &line, bool &done);
+
+private:
+    bool start(const string &file, string &error);
+    string run(long long count, uint32_t until);
+    string state_fields();
+    string delta_fields();
+
+    int trace_level;
+    int trace_stages;
+    string program;            // file of the last load, "" before the first
+    string trace;              // what the hart printed during the current request
+    uint32_t reported_X[32];   // register file as of the last delta
+    unique_ptr<Memory> memory; // declared before hart, so the hart goes first
+    unique_ptr<Hart> hart;
+};
+
+// Starts over with a fresh Memory and Hart, with file loaded unless it is empty.
+// returns false, with the malformed lines in error, if file does not load
+bool Server::start(const string &file, string &error)
+{
+    hart.reset();
+    memory.reset(new Memory());
+    hart.reset(new Hart(*memory));
+    hart->trace_level = trace_level;
+    hart->trace_stages = trace_stages;
+    hart->trace_buffer.capture = &trace;
+    // replies carry the state, so nothing is written to memory.mc or registerFile.mc
+    hart->memory_file = "";
+    hart->register_file = "";
+    hart->reset_proc();
+    memory->track_dirty = true;
+    vector<string> errors;
+    if (!file.empty() && !hart->load_program(file, errors))
+    {
+        for (const string &e : errors)
+        {
+            error += (error.empty() ? "" : "; ") + e;
+        }
+        return false;
+    }
+    program = file;
+
+    // deltas start from the state after loading
+    memory->take_dirty_ranges();
+    memcpy(reported_X, hart->X, sizeof(reported_X));
+    return true;
+}
+
+string Server::state_fields()
+{
+    const char *state = !hart->terminate1 ? "paused" : hart->halted ? "finished" : "error";
+    return string("\"state\":\"") + state + "\",\"pc\":" + to_string(hart->PC) +
+           ",\"cycles\":" + to_string(hart->clock_cycles);
+}
+
+string Server::delta_fields()
+{
+    string reply = ",\"delta\":{\"registers\":[";
+    bool first = true;
+    for (int i = 0; i < 32; i++)
+    {
+        if (hart->X[i] != reported_X[i])
+        {
+            reply += string(first ? "" : ",") + "[" + to_string(i) + "," + to_string(hart->X[i]) + "]";
+            reported_X[i] = hart->X[i];
+            first = false;
+        }
+    }
+
+    vector<pair<uint32_t, uint32_t>> ranges = memory->take_dirty_ranges();
+    long long total = 0;
+    for (const auto &range : ranges)
+    {
+        total += range.second;
+    }
+    reply += "],\"memory\":[";
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        reply += string(i ? "," : "") + "{\"address\":" + to_string(ranges[i].first) +
+                 ",\"length\":" + to_string(ranges[i].second);
+        if (total <= MAX_MEMORY_READ)
+        {
+            reply += ",\"bytes\":\"" + hex_bytes(*memory, ranges[i].first, ranges[i].second) + "\"";
+        }
+        reply += "}";
+    }
+    return reply + "]}";
+}
+
+// Runs at most count instructions (all of them if count is 0), stopping early at until
+string Server::run(long long count, uint32_t until)
+{
+    if (program.empty())
+    {
+        return error_reply("no program loaded");
+    }
+    if (hart->terminate1)
+    {
+        return error_reply("the program has ended; reset or load it again");
+    }
+
+    trace.clear();
+    hart->stop_cycle = (count > 0) ? stop_cycle_after(hart->clock_cycles, count) : NO_STOP_CYCLE;
+    hart->stop_pc = until;
+    if (hart->trace_level == TRACE_OFF)
+    {
+        hart->run_RISCVsim_fast();
+    }
+    else
+    {
+        hart->run_RISCVsim();
+    }
+    hart->stop_cycle = NO_STOP_CYCLE;
+    hart->stop_pc = NO_STOP_PC;
+    hart->trace_out.flush();
+
+    return "{\"ok\":true," + state_fields() + delta_fields() + ",\"trace\":" + json_string(trace) + "}";
+}
+
+string Server::handle(const string &line, bool &done)
+{
+    Request request;
+    string cmd;
+    long long count = 0, address = 0, length = 0;
+    try
+    {
+        string error;
+        if (!parse_request(line, request, error))
+        {
+            return error_reply(error);
+        }
+        cmd = request.text("cmd");
+
+        if (cmd == "load" || cmd == "reset")
+        {
+            string file = (cmd == "load") ? request.text("file") : program;
+            if (file.empty())
+            {
+                return error_reply(cmd == "load" ? "load needs a file" : "no program loaded");
+            }
+            if (!start(file, error))
+            {
+                start("", error);
+                return error_reply(file + ": " + error);
+            }
+            return "{\"ok\":true," + state_fields() + "}";
+        }
+        if (cmd == "step")
+        {
+            if (request.has("count") && (!request.number("count", count) || count < 1))
+            {
+                return error_reply("count must be a positive number");
+            }
+            return run(request.has("count") ? count : 1, NO_STOP_PC);
+        }
+        if (cmd == "run")
+        {
+            if (request.has("max") && (!request.number("max", count) || count < 1))
+            {
+                return error_reply("max must be a positive number");
+            }
+            if (request.has("until") && !request.number("until", address))
+            {
+                return error_reply("until must be an address");
+            }
+            return run(count, request.has("until") ? static_cast<uint32_t>(address) : NO_STOP_PC);
+        }
+        if (cmd == "registers")
+        {
+            string reply = "{\"ok\":true," + state_fields() + ",\"x\":[";
+            for (int i = 0; i < 32; i++)
+            {
+                reply += (i ? "," : "") + to_string(hart->X[i]);
+            }
+            return reply + "]}";
+        }
+        if (cmd == "memory")
+        {
+            if (!request.number("address", address) || !request.number("length", length) ||
+                length < 0 || length > MAX_MEMORY_READ)
+            {
+                return error_reply("memory needs an address and a length of at most " + to_string(MAX_MEMORY_READ));
+            }
+            return "{\"ok\":true,\"address\":" + to_string(static_cast<uint32_t>(address)) +
+                   ",\"bytes\":\"" + hex_bytes(*memory, static_cast<uint32_t>(address), length) + "\"}";
+        }
+        if (cmd == "trace")
+        {
+            // the same values as the command line options, kept for later loads
+            vector<string> args = {"--serve"};
+            if (request.has("level"))
+            {
+                args.insert(args.end(), {"--trace", request.text("level")});
+            }
+            if (request.has("stages"))
+            {
+                args.insert(args.end(), {"--trace-stages", request.text("stages")});
+            }
+            vector<char *> argv;
+            for (string &arg : args)
+            {
+                argv.push_back(&arg[0]);
+            }
+            for (int i = 1; i < static_cast<int>(argv.size()); i++)
+            {
+                hart->parse_trace_option(argv.size(), argv.data(), i);
+            }
+            trace_level = hart->trace_level;
+            trace_stages = hart->trace_stages;
+            return "{\"ok\":true}";
+        }
+        if (cmd == "quit")
+        {
+            done = true;
+            return "{\"ok\":true}";
+        }
+    }
+    catch (const exception &e)
+    {
+        // running out of memory while building a reply; the session stays usable
+        return error_reply(string("request failed: ") + e.what());
+    }
+    return error_reply("unknown cmd \"" + cmd + "\"");
+}
+
+// Reads a line without its newline; false at the end of the input
+static bool read_line(FILE *in, string &line)
+{
+    line.clear();
+    char chunk[4096];
+    while (fgets(chunk, sizeof(chunk), in))
+    {
+        line += chunk;
+        if (line.back() == '\n')
+        {
+            line.pop_back();
+            if (!line.empty() && line.back() == '\r')
+            {
+                line.pop_back();
+            }
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+static void serve_stream(Server &server, FILE *in, FILE *out, bool &done)
+{
+    string line;
+    while (!done && read_line(in, line))
+    {
+        if (line.find_first_not_of(" \t") == string::npos)
+        {
+            continue;
+        }
+        string reply = server.handle(line, done);
+        fputs(reply.c_str(), out);
+        fputc('\n', out);
+        fflush(out);
+    }
+}
+
+int serve(const string &socket_path, int trace_level, int trace_stages)
+{
+    Server server(trace_level, trace_stages);
+    bool done = false;
+    if (socket_path.empty())
+    {
+        serve_stream(server, stdin, stdout, done);
+        return 0;
+    }
+
+#ifdef HAVE_UNIX_SOCKETS
+    // one client at a time; the simulator state carries over between connections
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path))
+    {
+        cerr << "ERROR: socket path too long" << endl;
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path.c_str());
+    if (listener < 0 || ::bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+        listen(listener, 1) != 0)
+    {
+        cerr << "ERROR: cannot listen on " << socket_path << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN); // a client that goes away only ends its connection
+
+    while (!done)
+    {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+        {
+            continue;
+        }
+        FILE *in = fdopen(client, "r");
+        FILE *out = fdopen(dup(client), "w");
+        serve_stream(server, in, out, done);
+        fclose(in);
+        fclose(out);
+    }
+    close(listener);
+    unlink(socket_path.c_str());
+    return 0;
+#else
+    cerr << "ERROR: --socket needs Unix domain sockets" << endl;
+    return 1;
+#endif
+}
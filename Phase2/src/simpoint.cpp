@@ -0,0 +1,332 @@
+/* simpoint.cpp
+   SimPoint-style sampled simulation (--simpoint). A first run in the fast
+   engine splits the program into intervals of a fixed number of
+   instructions and records the basic-block vector of each. The vectors are
+   normalised and randomly projected to a few dimensions. k-means groups them
+   for every k up to the limit, and the smallest k whose BIC score comes
+   within 90% of the best is kept. The interval closest to the centre of each
+   cluster is its simulation point.
+
+   A second run starts from the same state, fast-forwards to each point,
+   warms the caches, predictor and pipeline up on the instructions before it
+   in run_RISCVsim(), and times the point itself. The CPI of the program is
+   the mean of the points' CPIs, weighted by the instructions of their clusters.
+*/
+
+#include "../include/myARMSim.h"
+
+const int PROJECTED_DIMENSIONS = 15;
+const int KMEANS_ITERATIONS = 100;
+const double BIC_THRESHOLD = 0.9;
+
+struct SimPoint
+{
+    int interval = -1;       // index of the interval
+    double weight = 0;       // fraction of all instructions in its cluster
+    long long cycles = 0;    // measured, warm-up excluded
+    long long instructions = 0;
+};
+
+// Assigns every point to one of k clusters, starting from k-means++ centres;
+// returns the sum of squared distances to the centres
+static double kmeans(const vector<vector<double>> &points, int k, vector<int> &cluster, vector<vector<double>> &centres)
+{
+    size_t n = points.size();
+    int dims = points[0].size();
+    auto distance = [&](const vector<double> &a, const vector<double> &b) {
+        double sum = 0;
+        for (int d = 0; d < dims; d++)
+        {
+            sum += (a[d] - b[d]) * (a[d] - b[d]);
+        }
+        return sum;
+    };
+
+    // k-means++: each further centre is drawn with probability proportional to its squared distance
+    mt19937 random(k);
+    centres.assign(1, points[random() % n]);
+    vector<double> nearest(n);
+    while (static_cast<int>(centres.size()) < k)
+    {
+        double total = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            nearest[i] = distance(points[i], centres[0]);
+            for (size_t c = 1; c < centres.size(); c++)
+            {
+                nearest[i] = min(nearest[i], distance(points[i], centres[c]));
+            }
+            total += nearest[i];
+        }
+        double pick = uniform_real_distribution<double>(0, total)(random);
+        size_t chosen = 0;
+        for (; chosen + 1 < n && pick >= nearest[chosen]; chosen++)
+        {
+            pick -= nearest[chosen];
+        }
+        centres.push_back(points[chosen]);
+    }
+
+    cluster.assign(n, -1);
+    double error = 0;
+    for (int iteration = 0; iteration < KMEANS_ITERATIONS; iteration++)
+    {
+        bool moved = false;
+        error = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            int best = 0;
+            double best_distance = distance(points[i], centres[0]);
+            for (int c = 1; c < k; c++)
+            {
+                double d = distance(points[i], centres[c]);
+                if (d < best_distance)
+                {
+                    best = c;
+                    best_distance = d;
+                }
+            }
+            moved |= (cluster[i] != best);
+            cluster[i] = best;
+            error += best_distance;
+        }
+        if (!moved)
+        {
+            break;
+        }
+
+        // move each centre to the mean of its points; an empty cluster keeps its centre
+        vector<vector<double>> sums(k, vector<double>(dims, 0.0));
+        vector<int> sizes(k, 0);
+        for (size_t i = 0; i < n; i++)
+        {
+            sizes[cluster[i]]++;
+            for (int d = 0; d < dims; d++)
+            {
+                sums[cluster[i]][d] += points[i][d];
+            }
+        }
+        for (int c = 0; c < k; c++)
+        {
+            for (int d = 0; sizes[c] && d < dims; d++)
+            {
+                centres[c][d] = sums[c][d] / sizes[c];
+            }
+        }
+    }
+    return error;
+}
+
+// Bayesian information criterion of a clustering, as in X-means: the log-likelihood of
+// the points under spherical Gaussians of one shared variance, less a penalty per parameter
+static double bic(const vector<int> &cluster, int k, int dims, double error)
+{
+    double n = cluster.size();
+    vector<int> sizes(k, 0);
+    for (int c : cluster)
+    {
+        sizes[c]++;
+    }
+    double variance = max(error / (dims * max(1.0, n - k)), 1e-12);
+    double likelihood = -n * dims / 2 * log(2 * M_PI * variance) - dims * (n - k) / 2;
+    for (int size : sizes)
+    {
+        likelihood += size ? size * log(size / n) : 0;
+    }
+    return likelihood - k * (dims + 1) / 2.0 * log(n);
+}
+
+void run_simpoints(Hart &hart, int interval, int max_clusters, int warmup, ostream &out)
+{
+    // keep the starting state for the timing run
+    Memory image;
+    image.copy_pages(hart.memory);
+    uint32_t start_pc = hart.PC;
+    uint32_t start_registers[32];
+    memcpy(start_registers, hart.X, sizeof(start_registers));
+    uint32_t start_written = hart.X_written;
+    long long start_cycle = hart.clock_cycles;
+
+    // Profile: the fast engine stops at every interval boundary
+    auto started = chrono::steady_clock::now();
+    BasicBlockProfile profile;
+    profile.block_start = hart.PC;
+    profile.block_start_cycle = hart.clock_cycles;
+    hart.profile = &profile;
+    vector<long long> lengths;
+    while (!hart.terminate1)
+    {
+        long long begin = hart.clock_cycles;
+        hart.stop_cycle = begin + interval;
+        hart.run_RISCVsim_fast();
+        profile.end_block(hart.PC, hart.clock_cycles);
+        lengths.push_back(hart.clock_cycles - begin);
+        if (!hart.terminate1)
+        {
+            profile.intervals.emplace_back();
+        }
+    }
+    hart.stop_cycle = NO_STOP_CYCLE;
+    hart.profile = nullptr;
+    if (lengths.size() > 1 && lengths.back() == 0)
+    {
+        // the program ended on an interval boundary
+        lengths.pop_back();
+        profile.intervals.pop_back();
+    }
+    long long total = hart.clock_cycles - start_cycle;
+    double profile_seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    // Project the normalised vectors with a random matrix, one row per block
+    size_t n = lengths.size();
+    uniform_real_distribution<double> entry(-1, 1);
+    map<uint32_t, vector<double>> rows;
+    vector<vector<double>> points(n, vector<double>(PROJECTED_DIMENSIONS, 0.0));
+    for (size_t i = 0; i < n; i++)
+    {
+        for (const auto &block : profile.intervals[i])
+        {
+            // the row of a block depends only on its address
+            vector<double> &row = rows[block.first];
+            if (row.empty())
+            {
+                mt19937 block_random(block.first);
+                for (int d = 0; d < PROJECTED_DIMENSIONS; d++)
+                {
+                    row.push_back(entry(block_random));
+                }
+            }
+            for (int d = 0; d < PROJECTED_DIMENSIONS; d++)
+            {
+                points[i][d] += row[d] * block.second / max(1LL, lengths[i]);
+            }
+        }
+    }
+
+    // Cluster for every k, keep the smallest within BIC_THRESHOLD of the best score
+    int most = min<int>(max_clusters, n);
+    vector<vector<int>> clusterings(most + 1);
+    vector<vector<vector<double>>> centres(most + 1);
+    vector<double> scores(most + 1);
+    for (int k = 1; k <= most; k++)
+    {
+        double error = kmeans(points, k, clusterings[k], centres[k]);
+        scores[k] = bic(clusterings[k], k, PROJECTED_DIMENSIONS, error);
+    }
+    double low = *min_element(scores.begin() + 1, scores.end());
+    double high = *max_element(scores.begin() + 1, scores.end());
+    int k = 1;
+    while (k < most && scores[k] < low + BIC_THRESHOLD * (high - low))
+    {
+        k++;
+    }
+    const vector<int> &cluster = clusterings[k];
+
+    // the interval nearest each centre stands for its cluster
+    vector<SimPoint> simpoints;
+    for (int c = 0; c < k; c++)
+    {
+        SimPoint point;
+        double nearest = 0;
+        long long instructions = 0;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (cluster[i] != c)
+            {
+                continue;
+            }
+            double d = 0;
+            for (int x = 0; x < PROJECTED_DIMENSIONS; x++)
+            {
+                d += (points[i][x] - centres[k][c][x]) * (points[i][x] - centres[k][c][x]);
+            }
+            if (point.interval < 0 || d < nearest)
+            {
+                point.interval = i;
+                nearest = d;
+            }
+            instructions += lengths[i];
+        }
+        if (point.interval >= 0)
+        {
+            point.weight = total ? static_cast<double>(instructions) / total : 1.0;
+            simpoints.push_back(point);
+        }
+    }
+    sort(simpoints.begin(), simpoints.end(), [](const SimPoint &a, const SimPoint &b) { return a.interval < b.interval; });
+
+    // Time the points on a second run from the starting state
+    started = chrono::steady_clock::now();
+    Memory memory;
+    memory.copy_pages(image);
+    Hart sampled(memory);
+    string discarded;
+    sampled.trace_level = TRACE_OFF;
+    sampled.trace_buffer.capture = &discarded; // the profile run already printed any error
+    sampled.memory_file.clear();
+    sampled.register_file.clear();
+    sampled.PC = start_pc;
+    memcpy(sampled.X, start_registers, sizeof(sampled.X));
+    sampled.X_written = start_written;
+    sampled.clock_cycles = start_cycle;
+    long long detailed = 0;
+    for (SimPoint &point : simpoints)
+    {
+        long long begin = start_cycle + static_cast<long long>(point.interval) * interval;
+        long long end = begin + lengths[point.interval];
+        long long warm = max(begin - warmup, sampled.clock_cycles);
+        if (sampled.clock_cycles < warm)
+        {
+            sampled.stop_cycle = warm;
+            sampled.run_RISCVsim_fast();
+        }
+
+        hart.pipeline->drain();
+        sampled.pipeline = hart.pipeline;
+        sampled.caches = hart.caches;
+        if (sampled.clock_cycles < begin && !sampled.terminate1)
+        {
+            sampled.stop_cycle = begin;
+            sampled.run_RISCVsim();
+        }
+        long long cycles = hart.pipeline->cycles;
+        if (!sampled.terminate1)
+        {
+            sampled.stop_cycle = end;
+            sampled.run_RISCVsim();
+        }
+        point.cycles = hart.pipeline->cycles - cycles;
+        point.instructions = sampled.clock_cycles - begin;
+        detailed += sampled.clock_cycles - warm;
+        sampled.pipeline = nullptr;
+        sampled.caches = nullptr;
+    }
+    double timing_seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    // Report
+    char line[256];
+    snprintf(line, sizeof(line), "SimPoint: %zu intervals of %d instructions, %d clusters (BIC), %d instructions of warm-up\n",
+             n, interval, k, warmup);
+    out << line;
+    snprintf(line, sizeof(line), "%5s %9s %12s %8s %12s %12s %7s\n", "Point", "Interval", "Start", "Weight",
+             "Instructions", "Cycles", "CPI");
+    out << line;
+    double cpi = 0;
+    for (size_t p = 0; p < simpoints.size(); p++)
+    {
+        const SimPoint &point = simpoints[p];
+        double point_cpi = point.instructions ? static_cast<double>(point.cycles) / point.instructions : 0.0;
+        cpi += point.weight * point_cpi;
+        snprintf(line, sizeof(line), "%5zu %9d %12lld %7.2f%% %12lld %12lld %7.3f\n", p, point.interval,
+                 start_cycle + static_cast<long long>(point.interval) * interval, 100 * point.weight, point.instructions,
+                 point.cycles, point_cpi);
+        out << line;
+    }
+    snprintf(line, sizeof(line), "Estimated CPI: %.3f, %.0f cycles for %lld instructions\n", cpi, cpi * total, total);
+    out << line;
+    snprintf(line, sizeof(line), "Detailed simulation: %lld instructions (%.2f%%), profile %.3f s, timing %.3f s\n",
+             detailed, total ? 100.0 * detailed / total : 0.0, profile_seconds, timing_seconds);
+    out << line;
+    out << "The pipeline and cache statistics below cover the timed points and their warm-up only" << '\n';
+    out.flush();
+}
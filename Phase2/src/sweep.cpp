@@ -0,0 +1,402 @@
+/* sweep.cpp
+   myRISCVSim --sweep grid.json PROGRAM: times one program under every
+   configuration of a parameter grid. The grid is a JSON object whose keys
+   are timing options, spelt as on the command line without the dashes, and
+   whose values are one value or a list of them:
+
+     {"icache": ["8K,2,64", "32K,4,64"],
+      "dcache": ["off", "16K,4,32"],
+      "predictor": ["2bit", "gshare"],
+      "forwarding": ["on", "off"]}
+
+   Every combination is one configuration (2 * 2 * 2 * 2 = 16 here). The
+   program is loaded once; each configuration copies that image into its own
+   Memory and runs the explain engine with the pipeline model and the caches
+   it asks for, on `threads` host threads. The CSV has a column per grid key,
+   then the status, instructions, cycles, CPI, the miss rate of each cache
+   (empty when there is none) and the branch and jump mispredictions.
+*/
+
+#include "../include/myARMSim.h"
+
+// Timing options of one configuration; options the grid leaves out keep the command-line defaults
+struct SweepSettings
+{
+    CacheConfig icache, dcache, l2;
+    ReplacementPolicy replacement = REPLACE_LRU;
+    WritePolicy write_policy = WRITE_BACK;
+    int l2_latency = L2_HIT_LATENCY, memory_latency = MAIN_MEMORY_LATENCY;
+    int forwarding = FORWARD_EX_EX | FORWARD_MEM_EX;
+    PredictorKind predictor = PREDICT_NOT_TAKEN;
+    int predictor_bits = 10, btb_entries = -1, btb_ways = 4, ras_entries = -1;
+};
+
+struct SweepJob
+{
+    vector<string> values; // one per grid key
+    SweepSettings settings;
+    string status = "not run";
+    long long instructions = 0, cycles = 0;
+    double miss_rate[3] = {-1, -1, -1}; // I-cache, D-cache, L2; -1 when absent
+    long long branches = 0, mispredictions = 0;
+};
+
+// Applies key = value to settings; false with the reason in error if either is not valid
+static bool apply_setting(SweepSettings &settings, const string &key, const string &value, string &error)
+{
+    bool ok = true;
+    try
+    {
+        if (key == "icache" || key == "dcache" || key == "l2")
+        {
+            CacheConfig &config = (key == "icache") ? settings.icache : (key == "dcache") ? settings.dcache : settings.l2;
+            ok = parse_cache_config(value, config);
+        }
+        else if (key == "replacement")
+        {
+            ok = (value == "lru" || value == "fifo" || value == "random");
+            settings.replacement = (value == "lru") ? REPLACE_LRU : (value == "fifo") ? REPLACE_FIFO : REPLACE_RANDOM;
+        }
+        else if (key == "write-policy")
+        {
+            ok = (value == "write-back" || value == "write-through");
+            settings.write_policy = (value == "write-back") ? WRITE_BACK : WRITE_THROUGH;
+        }
+        else if (key == "l2-latency" || key == "memory-latency")
+        {
+            int &latency = (key == "l2-latency") ? settings.l2_latency : settings.memory_latency;
+            latency = stoi(value);
+            ok = latency >= 0;
+        }
+        else if (key == "forwarding")
+        {
+            ok = parse_forwarding(value, settings.forwarding);
+        }
+        else if (key == "predictor")
+        {
+            ok = parse_predictor(value, settings.predictor);
+        }
+        else if (key == "predictor-bits")
+        {
+            settings.predictor_bits = stoi(value);
+            ok = settings.predictor_bits >= 1 && settings.predictor_bits <= 24;
+        }
+        else if (key == "btb")
+        {
+            ok = sscanf(value.c_str(), "%d,%d", &settings.btb_entries, &settings.btb_ways) >= 1 &&
+                 settings.btb_entries >= 0 && settings.btb_ways >= 1;
+        }
+        else if (key == "ras")
+        {
+            settings.ras_entries = stoi(value);
+            ok = settings.ras_entries >= 0;
+        }
+        else
+        {
+            error = "unknown parameter \"" + key + "\"";
+            return false;
+        }
+    }
+    catch (const exception &)
+    {
+        ok = false;
+    }
+    if (!ok)
+    {
+        error = "\"" + value + "\" is not a valid " + key;
+    }
+    return ok;
+}
+
+static void skip_space(const string &s, size_t &i)
+{
+    while (i < s.size() && isspace(static_cast<unsigned char>(s[i])))
+    {
+        i++;
+    }
+}
+
+// Reads a JSON string (escapes other than \" and \\ are not needed for option values),
+// number or boolean starting at s[i] into value
+static bool parse_value(const string &s, size_t &i, string &value)
+{
+    value.clear();
+    if (i < s.size() && s[i] == '"')
+    {
+        for (i++; i < s.size() && s[i] != '"'; i++)
+        {
+            if (s[i] == '\\' && i + 1 < s.size())
+            {
+                i++;
+            }
+            value += s[i];
+        }
+        return i++ < s.size();
+    }
+    size_t end = s.find_first_of(",]} \t\r\n", i);
+    value = s.substr(i, end == string::npos ? string::npos : end - i);
+    i = (end == string::npos) ? s.size() : end;
+    return !value.empty() && value[0] != '{' && value[0] != '[';
+}
+
+// Parses the grid: an object of keys with a value or a list of values each
+static bool parse_grid(const string &s, vector<pair<string, vector<string>>> &grid, string &error)
+{
+    size_t i = 0;
+    skip_space(s, i);
+    if (i == s.size() || s[i] != '{')
+    {
+        error = "the grid is a JSON object";
+        return false;
+    }
+    i++;
+    skip_space(s, i);
+    while (i < s.size() && s[i] != '}')
+    {
+        string key;
+        if (s[i] != '"' || !parse_value(s, i, key))
+        {
+            error = "expected a string key";
+            return false;
+        }
+        skip_space(s, i);
+        if (i == s.size() || s[i] != ':')
+        {
+            error = "expected ':' after \"" + key + "\"";
+            return false;
+        }
+        i++;
+        skip_space(s, i);
+        vector<string> values;
+        bool list = (i < s.size() && s[i] == '[');
+        i += list;
+        skip_space(s, i);
+        while (!(list && i < s.size() && s[i] == ']'))
+        {
+            string value;
+            if (!parse_value(s, i, value))
+            {
+                error = "the values of \"" + key + "\" must be strings, numbers or booleans";
+                return false;
+            }
+            values.push_back(value);
+            skip_space(s, i);
+            if (!list)
+            {
+                break;
+            }
+            if (i < s.size() && s[i] == ',')
+            {
+                i++;
+                skip_space(s, i);
+            }
+            else if (i == s.size() || s[i] != ']')
+            {
+                error = "expected ',' or ']' in the values of \"" + key + "\"";
+                return false;
+            }
+        }
+        i += list;
+        if (values.empty())
+        {
+            error = "\"" + key + "\" has no values";
+            return false;
+        }
+        grid.emplace_back(key, values);
+        skip_space(s, i);
+        if (i < s.size() && s[i] == ',')
+        {
+            i++;
+            skip_space(s, i);
+        }
+        else if (i == s.size() || s[i] != '}')
+        {
+            error = "expected ',' or '}'";
+            return false;
+        }
+    }
+    if (i == s.size())
+    {
+        error = "missing '}'";
+        return false;
+    }
+    return true;
+}
+
+// Runs the configuration of job on a copy of image, started as start was
+static void run_job(SweepJob &job, const Memory &image, const Hart &start)
+{
+    const SweepSettings &s = job.settings;
+    Memory memory;
+    memory.copy_pages(image);
+    Hart hart(memory);
+    string trace;
+    hart.trace_level = TRACE_OFF;
+    hart.trace_buffer.capture = &trace; // error messages
+    hart.memory_file.clear();
+    hart.register_file.clear();
+    hart.PC = start.PC;
+    memcpy(hart.X, start.X, sizeof(hart.X));
+    hart.X_written = start.X_written;
+
+    // the same defaults as the command line
+    bool dynamic = (s.predictor != PREDICT_NOT_TAKEN);
+    BranchUnit branches(s.predictor, s.predictor_bits, (s.btb_entries < 0) ? (dynamic ? 512 : 0) : s.btb_entries,
+                        s.btb_ways, (s.ras_entries < 0) ? (dynamic ? 8 : 0) : s.ras_entries);
+    PipelineModel pipeline(s.forwarding, &branches);
+    hart.pipeline = &pipeline;
+    unique_ptr<CacheHierarchy> caches;
+    if (s.icache.size || s.dcache.size)
+    {
+        caches.reset(new CacheHierarchy(s.icache, s.dcache, s.l2, s.replacement, s.write_policy,
+                                        s.l2_latency, s.memory_latency));
+        hart.caches = caches.get();
+    }
+
+    hart.run_RISCVsim();
+    pipeline.drain();
+
+    job.status = hart.halted ? "finished" : "error";
+    job.instructions = pipeline.instructions;
+    job.cycles = pipeline.cycles;
+    if (caches)
+    {
+        const Cache *levels[3] = {caches->icache.get(), caches->dcache.get(), caches->l2.get()};
+        for (int k = 0; k < 3; k++)
+        {
+            job.miss_rate[k] = levels[k] ? levels[k]->miss_rate() : -1;
+        }
+    }
+    job.branches = branches.branches + branches.jumps;
+    job.mispredictions = branches.branch_mispredictions + branches.jump_mispredictions;
+}
+
+// a CSV field, quoted when it holds a comma or a quote
+static string csv_field(const string &value)
+{
+    if (value.find_first_of(",\"") == string::npos)
+    {
+        return value;
+    }
+    string out = "\"";
+    for (char c : value)
+    {
+        out += (c == '"') ? "\"\"" : string(1, c);
+    }
+    return out + "\"";
+}
+
+int run_sweep(const string &grid_file, const string &program, int threads, const string &output_file)
+{
+    ifstream in(grid_file);
+    if (!in)
+    {
+        cerr << "ERROR: cannot open " << grid_file << endl;
+        return 1;
+    }
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    vector<pair<string, vector<string>>> grid;
+    string error;
+    if (!parse_grid(text, grid, error))
+    {
+        cerr << "ERROR: " << grid_file << ": " << error << endl;
+        return 1;
+    }
+
+    // every combination of the values, the last key changing fastest
+    size_t count = 1;
+    for (const auto &axis : grid)
+    {
+        count *= axis.second.size();
+    }
+    vector<SweepJob> jobs(count);
+    for (size_t j = 0; j < count; j++)
+    {
+        size_t rest = j;
+        jobs[j].values.resize(grid.size());
+        for (size_t k = grid.size(); k-- > 0;)
+        {
+            const vector<string> &values = grid[k].second;
+            jobs[j].values[k] = values[rest % values.size()];
+            rest /= values.size();
+        }
+        for (size_t k = 0; k < grid.size(); k++)
+        {
+            if (!apply_setting(jobs[j].settings, grid[k].first, jobs[j].values[k], error))
+            {
+                cerr << "ERROR: " << grid_file << ": " << error << endl;
+                return 1;
+            }
+        }
+        const SweepSettings &s = jobs[j].settings;
+        if (s.l2.size && !s.icache.size && !s.dcache.size)
+        {
+            cerr << "ERROR: " << grid_file << ": an l2 needs an icache or dcache in front of it" << endl;
+            return 1;
+        }
+    }
+
+    // the program is loaded once; the jobs only read this image
+    Memory image;
+    Hart start(image);
+    start.reset_proc();
+    start.load_program_memory(program);
+
+    atomic<size_t> next_job(0);
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next_job++) < jobs.size())
+        {
+            run_job(jobs[i], image, start);
+        }
+    };
+    auto started = chrono::steady_clock::now();
+    vector<thread> pool;
+    for (int t = 0; t < min<int>(threads, jobs.size()); t++)
+    {
+        pool.emplace_back(worker);
+    }
+    for (thread &t : pool)
+    {
+        t.join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+
+    ofstream out(output_file);
+    if (!out)
+    {
+        cerr << "ERROR: cannot write " << output_file << endl;
+        return 1;
+    }
+    for (const auto &axis : grid)
+    {
+        out << csv_field(axis.first) << ',';
+    }
+    out << "status,instructions,cycles,cpi,icache_miss_rate,dcache_miss_rate,l2_miss_rate,"
+        << "branches,mispredictions,misprediction_rate\n";
+    int failed = 0;
+    for (const SweepJob &job : jobs)
+    {
+        for (const string &value : job.values)
+        {
+            out << csv_field(value) << ',';
+        }
+        char line[256];
+        snprintf(line, sizeof(line), "%s,%lld,%lld,%.4f", job.status.c_str(), job.instructions, job.cycles,
+                 job.instructions ? static_cast<double>(job.cycles) / job.instructions : 0.0);
+        out << line;
+        for (double rate : job.miss_rate)
+        {
+            snprintf(line, sizeof(line), ",%.6f", rate);
+            out << ((rate < 0) ? "," : line);
+        }
+        snprintf(line, sizeof(line), ",%lld,%lld,%.6f\n", job.branches, job.mispredictions,
+                 job.branches ? static_cast<double>(job.mispredictions) / job.branches : 0.0);
+        out << line;
+        failed += job.status != "finished";
+    }
+
+    printf("%zu configurations on %d threads, %d not finished, %.3f s; results in %s\n", jobs.size(),
+           min<int>(threads, jobs.size()), failed, seconds, output_file.c_str());
+    return failed ? 1 : 0;
+}